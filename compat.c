@@ -0,0 +1,889 @@
+/*
+ * Copyright (c) 2013,2016-2017 Greg Becker.  All rights reserved.
+ *
+ * Performance test module.
+ *
+ * Userspace implementation of the kernel shims declared in compat.h,
+ * plus a sysctl(8)-like main() that drives the debug.pmt.* oids.
+ */
+
+#include "compat.h"
+#include "pmt.h"
+
+#include <linux/mempolicy.h>
+
+#include <getopt.h>
+#include <limits.h>
+#include <sysexits.h>
+
+#define PMT_SYSCTL_PREFIX   "debug.pmt."
+
+uint64_t tsc_freq;
+char cpu_model[128];
+
+static struct sysctl_oid *pmt_oids;
+static moduledata_t *pmt_module;
+static const char *progname;
+
+
+size_t
+pmt_strlcpy(char *dst, const char *src, size_t dstsz)
+{
+    size_t len = strlen(src);
+
+    if (dstsz > 0) {
+        size_t n = (len < dstsz) ? len : dstsz - 1;
+
+        memcpy(dst, src, n);
+        dst[n] = '\000';
+    }
+
+    return len;
+}
+
+
+/* Calibrate tsc_freq against the monotonic clock.
+ */
+static void
+pmt_tsc_calibrate(void)
+{
+    struct timespec ts0, ts1, req;
+    uint64_t tsc0, tsc1, nsecs;
+
+#if !defined(__x86_64__) && !defined(__i386__)
+#if defined(__aarch64__)
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r" (tsc_freq));
+#else
+    tsc_freq = 1000000000ul;
+#endif
+    if (tsc_freq)
+        return;
+#endif
+
+    req.tv_sec = 0;
+    req.tv_nsec = 100 * 1000 * 1000;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts0);
+    tsc0 = rdtsc();
+    nanosleep(&req, NULL);
+    tsc1 = rdtsc();
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts1);
+
+    nsecs = (ts1.tv_sec - ts0.tv_sec) * 1000000000ul;
+    nsecs += ts1.tv_nsec - ts0.tv_nsec;
+
+    tsc_freq = ((tsc1 - tsc0) * 1000000ul) / (nsecs / 1000);
+}
+
+
+struct domainset domainset_prefer[MAXMEMDOM];
+struct domainset domainset_roundrobin;
+int vm_ndomains = 1;
+
+static struct pcpu pmt_pcpu[MAXCPU];
+
+/* Get the CPU model from the first "model name" in /proc/cpuinfo.
+ */
+static void
+pmt_cpu_model_init(void)
+{
+    char buf[256], *val;
+    FILE *fp;
+
+    strlcpy(cpu_model, "unknown", sizeof(cpu_model));
+
+    fp = fopen("/proc/cpuinfo", "r");
+    if (!fp)
+        return;
+
+    while (fgets(buf, sizeof(buf), fp)) {
+        if (strncmp(buf, "model name", 10))
+            continue;
+
+        val = strchr(buf, ':');
+        if (!val)
+            continue;
+
+        for (++val; *val == ' ' || *val == '\t'; ++val)
+            continue;
+
+        val[strcspn(val, "\n")] = '\000';
+        strlcpy(cpu_model, val, sizeof(cpu_model));
+        break;
+    }
+
+    fclose(fp);
+}
+
+/* Learn the NUMA node of each vCPU from sysfs.  If there's no sysfs
+ * node information then everything is in domain 0.
+ */
+static void
+pmt_numa_init(void)
+{
+    char path[128], buf[1024], *cur, *end;
+    u_long first, last;
+    int domain;
+    FILE *fp;
+
+    for (domain = 0; domain < MAXMEMDOM; ++domain) {
+        domainset_prefer[domain].ds_policy = DOMAINSET_POLICY_PREFER;
+        domainset_prefer[domain].ds_prefer = domain;
+    }
+
+    domainset_roundrobin.ds_policy = DOMAINSET_POLICY_ROUNDROBIN;
+    domainset_roundrobin.ds_prefer = -1;
+
+    for (domain = 0; domain < MAXMEMDOM; ++domain) {
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/node/node%d/cpulist", domain);
+
+        fp = fopen(path, "r");
+        if (!fp)
+            continue;
+
+        if (!fgets(buf, sizeof(buf), fp))
+            buf[0] = '\000';
+        fclose(fp);
+
+        vm_ndomains = domain + 1;
+
+        /* Parse a cpulist such as "0-15,32-47".
+         */
+        for (cur = buf; *cur && *cur != '\n'; cur = end) {
+            first = last = strtoul(cur, &end, 10);
+            if (end == cur)
+                break;
+            if (*end == '-')
+                last = strtoul(end + 1, &end, 10);
+            if (*end == ',')
+                ++end;
+
+            while (first <= last && first < MAXCPU)
+                pmt_pcpu[first++].pc_domain = domain;
+        }
+    }
+}
+
+struct pcpu *
+pcpu_find(u_int cpuid)
+{
+    return &pmt_pcpu[cpuid < MAXCPU ? cpuid : 0];
+}
+
+/* Return the first number in the given sysfs file (e.g., the first vCPU
+ * of a cpulist), or dflt if there is no such file.
+ */
+static long
+pmt_sysfs_long(const char *path, long dflt)
+{
+    char buf[64];
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if (!fp)
+        return dflt;
+
+    if (fgets(buf, sizeof(buf), fp))
+        dflt = strtol(buf, NULL, 10);
+    fclose(fp);
+
+    return dflt;
+}
+
+/* Build the topology tree from each vCPU's package and the first of its
+ * SMT siblings.  Without sysfs each vCPU is a core of package 0.
+ */
+struct cpu_group *
+smp_topo(void)
+{
+    static struct cpu_group root, *pkgv, *corev;
+    static int pkgv_[MAXCPU], corev_[MAXCPU];
+    char path[128];
+    int ncpus, npkgs, ncores;
+    int cpu, p, c;
+
+    if (root.cg_count > 0)
+        return &root;
+
+    ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    ncpus = MIN(MAX(ncpus, 1), MAXCPU);
+
+    for (cpu = 0; cpu < ncpus; ++cpu) {
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        pkgv_[cpu] = pmt_sysfs_long(path, 0);
+
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+        corev_[cpu] = pmt_sysfs_long(path, cpu);
+    }
+
+    pkgv = calloc(ncpus, sizeof(*pkgv));
+    corev = calloc(ncpus, sizeof(*corev));
+    if (!pkgv || !corev)
+        abort();
+
+    root.cg_level = CG_SHARE_NONE;
+    root.cg_child = pkgv;
+    npkgs = ncores = 0;
+
+    /* Each package's cores are contiguous in corev[], in the order of
+     * the first vCPU of each.
+     */
+    for (cpu = 0; cpu < ncpus; ++cpu) {
+        struct cpu_group *pkg;
+
+        for (p = 0; p < npkgs; ++p) {
+            if (CPU_ISSET(cpu, &pkgv[p].cg_mask))
+                break;
+        }
+
+        if (p < npkgs)
+            continue;
+
+        pkg = &pkgv[npkgs++];
+        pkg->cg_parent = &root;
+        pkg->cg_child = &corev[ncores];
+        pkg->cg_level = CG_SHARE_L3;
+
+        for (c = cpu; c < ncpus; ++c) {
+            struct cpu_group *core;
+            int t;
+
+            if (pkgv_[c] != pkgv_[cpu] || corev_[c] != c)
+                continue;
+
+            core = &corev[ncores++];
+            core->cg_parent = pkg;
+            core->cg_level = CG_SHARE_L1;
+            ++pkg->cg_children;
+
+            for (t = c; t < ncpus; ++t) {
+                if (corev_[t] == c && pkgv_[t] == pkgv_[c]) {
+                    CPU_SET(t, &core->cg_mask);
+                    CPU_SET(t, &pkg->cg_mask);
+                    CPU_SET(t, &root.cg_mask);
+                    ++core->cg_count;
+                    ++pkg->cg_count;
+                    ++root.cg_count;
+                }
+            }
+
+            if (core->cg_count > 1)
+                core->cg_flags |= CG_FLAG_SMT;
+        }
+    }
+
+    root.cg_children = npkgs;
+
+    return &root;
+}
+
+int
+vm_phys_domain(vm_paddr_t pa)
+{
+    int node = 0;
+
+    if (syscall(SYS_get_mempolicy, &node, NULL, 0, (void *)(uintptr_t)pa,
+                MPOL_F_NODE | MPOL_F_ADDR))
+        return 0;
+
+    return node;
+}
+
+
+struct thread *
+pmt_curthread(void)
+{
+    static __thread struct thread td;
+
+    if (!td.td_tid)
+        td.td_tid = syscall(SYS_gettid);
+
+    return &td;
+}
+
+int
+cpuset_which(int which, id_t id, struct proc **pp, struct thread **tdp,
+             struct cpuset **setp)
+{
+    static struct cpuset set;
+
+    if (sched_getaffinity(0, sizeof(set.cs_mask), &set.cs_mask))
+        return errno;
+
+    *setp = &set;
+
+    return 0;
+}
+
+void
+cpuset_rel(struct cpuset *set)
+{
+}
+
+int
+cpuset_setthread(pid_t tid, cpuset_t *mask)
+{
+    return sched_setaffinity(tid, sizeof(*mask), mask) ? errno : 0;
+}
+
+/* Print a cpuset as a comma separated list of hex words, least
+ * significant word first (the same format as the kernel).
+ */
+char *
+cpusetobj_strprint(char *buf, const cpuset_t *set)
+{
+    char *tbuf = buf;
+    size_t bufsiz = CPUSETBUFSIZ;
+    int bytesp, i;
+
+    for (i = 0; i < _NCPUWORDS - 1; ++i) {
+        bytesp = snprintf(tbuf, bufsiz, "%lx,", set->__bits[i]);
+        bufsiz -= bytesp;
+        tbuf += bytesp;
+    }
+
+    snprintf(tbuf, bufsiz, "%lx", set->__bits[_NCPUWORDS - 1]);
+
+    return buf;
+}
+
+int
+cpusetobj_strscan(cpuset_t *set, const char *buf)
+{
+    u_int nwords;
+    int i, ret;
+
+    if (strlen(buf) > CPUSETBUFSIZ - 1)
+        return -1;
+
+    for (nwords = 1, i = 0; buf[i]; ++i) {
+        if (buf[i] == ',')
+            ++nwords;
+    }
+
+    if (nwords > _NCPUWORDS)
+        return -1;
+
+    CPU_ZERO(set);
+
+    for (i = 0; i < nwords; ++i) {
+        ret = sscanf(buf, "%lx", &set->__bits[i]);
+        if (ret == 0 || ret == -1)
+            return -1;
+
+        buf = strstr(buf, ",");
+        if (!buf)
+            break;
+        ++buf;
+    }
+
+    return 0;
+}
+
+
+void *
+pmt_malloc(size_t size, struct malloc_type *type, int flags)
+{
+    return (flags & M_ZERO) ? calloc(1, size) : (malloc)(size);
+}
+
+void
+pmt_free(void *addr, struct malloc_type *type)
+{
+    (free)(addr);
+}
+
+/* Allocate size bytes aligned to alignment from the domain(s) given by
+ * ds (if not NULL).  The region is faulted in up front so that the first
+ * test sample doesn't pay for it.  Binding the region to a node is only
+ * a preference, so any mbind() failure is ignored.
+ */
+void *
+contigmalloc_domainset(u_long size, struct malloc_type *type,
+                       struct domainset *ds, int flags,
+                       vm_paddr_t low, vm_paddr_t high,
+                       u_long alignment, vm_paddr_t boundary)
+{
+    uintptr_t addr, aligned;
+    u_long nodemask;
+    size_t len;
+    void *mem;
+
+    if (alignment < PAGE_SIZE)
+        alignment = PAGE_SIZE;
+
+    len = size + alignment;
+
+    mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return NULL;
+
+    addr = (uintptr_t)mem;
+    aligned = roundup(addr, alignment);
+
+    if (aligned > addr)
+        munmap(mem, aligned - addr);
+    if (aligned + size < addr + len)
+        munmap((void *)(aligned + size), (addr + len) - (aligned + size));
+
+    mem = (void *)aligned;
+
+    if (ds && vm_ndomains > 1) {
+        if (ds->ds_policy == DOMAINSET_POLICY_ROUNDROBIN) {
+            nodemask = (vm_ndomains < 64) ? (1ul << vm_ndomains) - 1 : ~0ul;
+            syscall(SYS_mbind, mem, size, MPOL_INTERLEAVE,
+                    &nodemask, sizeof(nodemask) * 8, 0);
+        } else {
+            nodemask = 1ul << ds->ds_prefer;
+            syscall(SYS_mbind, mem, size, MPOL_PREFERRED,
+                    &nodemask, sizeof(nodemask) * 8, 0);
+        }
+    }
+
+    madvise(mem, size, MADV_HUGEPAGE);
+    memset(mem, 0, size);
+
+    return mem;
+}
+
+void *
+contigmalloc(u_long size, struct malloc_type *type, int flags,
+             uint64_t low, uint64_t high, u_long alignment, uint64_t boundary)
+{
+    return contigmalloc_domainset(size, type, NULL, flags,
+                                  low, high, alignment, boundary);
+}
+
+void
+contigfree(void *addr, u_long size, struct malloc_type *type)
+{
+    munmap(addr, size);
+}
+
+
+int
+msleep(void *chan, struct mtx *m, int pri, const char *wmesg, int timo)
+{
+    mtx_unlock(m);
+    usleep((timo * 1000000ul) / hz);
+    mtx_lock(m);
+
+    return EWOULDBLOCK;
+}
+
+int
+pmt_cv_timedwait(struct cv *cv, struct mtx *m, int timo)
+{
+    struct timespec ts;
+    u_long nsecs;
+    int rc;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    nsecs = ts.tv_nsec + (timo * 1000000000ul) / hz;
+    ts.tv_sec += nsecs / 1000000000ul;
+    ts.tv_nsec = nsecs % 1000000000ul;
+
+    rc = pthread_cond_timedwait(&cv->cv_cond, &m->mtx_mutex, &ts);
+
+    return (rc == ETIMEDOUT) ? EWOULDBLOCK : rc;
+}
+
+
+struct sbuf {
+    char   *s_buf;
+    size_t  s_size;
+    size_t  s_len;
+};
+
+struct sbuf *
+sbuf_new_auto(void)
+{
+    struct sbuf *sb;
+
+    sb = calloc(1, sizeof(*sb));
+    if (!sb)
+        return NULL;
+
+    sb->s_size = 4096;
+    sb->s_buf = (malloc)(sb->s_size);
+    if (!sb->s_buf) {
+        (free)(sb);
+        return NULL;
+    }
+
+    sb->s_buf[0] = '\000';
+
+    return sb;
+}
+
+void
+sbuf_clear(struct sbuf *sb)
+{
+    sb->s_len = 0;
+    sb->s_buf[0] = '\000';
+}
+
+static int
+sbuf_vprintf(struct sbuf *sb, const char *fmt, va_list ap)
+{
+    va_list aq;
+    int len;
+
+    while (1) {
+        va_copy(aq, ap);
+        len = vsnprintf(sb->s_buf + sb->s_len, sb->s_size - sb->s_len, fmt, aq);
+        va_end(aq);
+
+        if (len < 0)
+            return -1;
+
+        if (sb->s_len + len < sb->s_size)
+            break;
+
+        char *buf = realloc(sb->s_buf, (sb->s_len + len + 1) * 2);
+        if (!buf)
+            return -1;
+
+        sb->s_size = (sb->s_len + len + 1) * 2;
+        sb->s_buf = buf;
+    }
+
+    sb->s_len += len;
+
+    return 0;
+}
+
+int
+sbuf_printf(struct sbuf *sb, const char *fmt, ...)
+{
+    va_list ap;
+    int rc;
+
+    va_start(ap, fmt);
+    rc = sbuf_vprintf(sb, fmt, ap);
+    va_end(ap);
+
+    return rc;
+}
+
+int
+sbuf_cat(struct sbuf *sb, const char *str)
+{
+    return sbuf_printf(sb, "%s", str);
+}
+
+int
+sbuf_finish(struct sbuf *sb)
+{
+    return 0;
+}
+
+char *
+sbuf_data(struct sbuf *sb)
+{
+    return sb->s_buf;
+}
+
+ssize_t
+sbuf_len(struct sbuf *sb)
+{
+    return sb->s_len;
+}
+
+void
+sbuf_delete(struct sbuf *sb)
+{
+    (free)(sb->s_buf);
+    (free)(sb);
+}
+
+
+void
+sysctl_register_oid(struct sysctl_oid *oidp)
+{
+    struct sysctl_oid **pp = &pmt_oids;
+
+    while (*pp)
+        pp = &(*pp)->oid_next;
+
+    *pp = oidp;
+}
+
+int
+sysctl_out(struct sysctl_req *req, const void *p, size_t l)
+{
+    if (req->oldsb)
+        sbuf_printf(req->oldsb, "%.*s", (int)strnlen(p, l), (const char *)p);
+
+    return 0;
+}
+
+int
+sysctl_in(struct sysctl_req *req, void *p, size_t l)
+{
+    if (!req->newptr || l > req->newlen)
+        return EINVAL;
+
+    memcpy(p, req->newptr, l);
+
+    return 0;
+}
+
+int
+sysctl_handle_string(SYSCTL_HANDLER_ARGS)
+{
+    if (req->oldsb)
+        sbuf_cat(req->oldsb, arg1);
+
+    if (!req->newptr)
+        return 0;
+
+    if (req->newlen >= arg2)
+        return EINVAL;
+
+    memcpy(arg1, req->newptr, req->newlen);
+    ((char *)arg1)[req->newlen] = '\000';
+
+    return 0;
+}
+
+static int
+sysctl_handle_number(SYSCTL_HANDLER_ARGS, uint64_t max)
+{
+    unsigned long long val;
+    char *end;
+
+    if (req->oldsb) {
+        if (max == UINT_MAX)
+            sbuf_printf(req->oldsb, "%u", *(u_int *)arg1);
+        else
+            sbuf_printf(req->oldsb, "%lu", (u_long)*(uint64_t *)arg1);
+    }
+
+    if (!req->newptr)
+        return 0;
+
+    errno = 0;
+    val = strtoull(req->newptr, &end, 0);
+    if (errno || end == req->newptr || *end || val > max)
+        return EINVAL;
+
+    if (max == UINT_MAX)
+        *(u_int *)arg1 = val;
+    else
+        *(uint64_t *)arg1 = val;
+
+    return 0;
+}
+
+int
+sysctl_handle_uint(SYSCTL_HANDLER_ARGS)
+{
+    return sysctl_handle_number(oidp, arg1, arg2, req, UINT_MAX);
+}
+
+int
+sysctl_handle_64(SYSCTL_HANDLER_ARGS)
+{
+    return sysctl_handle_number(oidp, arg1, arg2, req, UINT64_MAX);
+}
+
+static struct sysctl_oid *
+sysctl_find_oid(const char *name, size_t namelen)
+{
+    struct sysctl_oid *oidp;
+    size_t prefixlen;
+
+    prefixlen = strlen(PMT_SYSCTL_PREFIX);
+
+    if (namelen > prefixlen && 0 == strncmp(name, PMT_SYSCTL_PREFIX, prefixlen)) {
+        name += prefixlen;
+        namelen -= prefixlen;
+    }
+
+    for (oidp = pmt_oids; oidp; oidp = oidp->oid_next) {
+        if (strlen(oidp->oid_name) == namelen &&
+            0 == strncmp(oidp->oid_name, name, namelen))
+            return oidp;
+    }
+
+    return NULL;
+}
+
+
+void
+pmt_module_register(moduledata_t *mod)
+{
+    pmt_module = mod;
+}
+
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: %s [-adhn] [name[=value] ...]\n", progname);
+    fprintf(stderr, "usage: %s -h for more detail\n", progname);
+}
+
+static void
+help(void)
+{
+    fprintf(stdout, "usage: %s [-adhn] [name[=value] ...]\n", progname);
+    fprintf(stdout, "usage: %s -h\n", progname);
+    fprintf(stdout, "-a  show all oids\n");
+    fprintf(stdout, "-d  show oid descriptions rather than values\n");
+    fprintf(stdout, "-h  show this help message\n");
+    fprintf(stdout, "-n  show only values (omit oid names)\n");
+    fprintf(stdout, "name   show the value of debug.pmt.name\n");
+    fprintf(stdout, "name=value  set debug.pmt.name to value (e.g., run=0x3)\n");
+    fprintf(stdout, "\nExample:\n");
+    fprintf(stdout, "  %s tests=\"null func atomic_add_long\" run=0x1 results\n", progname);
+}
+
+/* Show and/or set the oid named by arg, in the manner of sysctl(8).
+ */
+static int
+pmt_sysctl(const char *arg, int descr, int noname)
+{
+    struct sysctl_oid *oidp;
+    struct sysctl_req req;
+    const char *value;
+    size_t namelen;
+    int rc;
+
+    value = strchr(arg, '=');
+    namelen = value ? value - arg : strlen(arg);
+
+    oidp = sysctl_find_oid(arg, namelen);
+    if (!oidp) {
+        fprintf(stderr, "%s: unknown oid '%.*s'\n", progname, (int)namelen, arg);
+        return ENOENT;
+    }
+
+    if (descr) {
+        if (!noname)
+            fprintf(stdout, "%s%s: ", PMT_SYSCTL_PREFIX, oidp->oid_name);
+        fprintf(stdout, "%s\n", oidp->oid_descr);
+        return 0;
+    }
+
+    memset(&req, 0, sizeof(req));
+
+    req.oldsb = sbuf_new_auto();
+    if (!req.oldsb)
+        return ENOMEM;
+
+    if (value) {
+        req.newptr = value + 1;
+        req.newlen = strlen(req.newptr);
+    }
+
+    rc = oidp->oid_handler(oidp, oidp->oid_arg1, oidp->oid_arg2, &req);
+    if (rc == PMT_EREGRESS) {
+        fprintf(stderr, "%s: %s%s: regressions found\n",
+                progname, PMT_SYSCTL_PREFIX, oidp->oid_name);
+    } else if (rc) {
+        fprintf(stderr, "%s: %s%s: %s\n",
+                progname, PMT_SYSCTL_PREFIX, oidp->oid_name, strerror(rc));
+    } else {
+        sbuf_finish(req.oldsb);
+
+        if (!noname)
+            fprintf(stdout, "%s%s: ", PMT_SYSCTL_PREFIX, oidp->oid_name);
+        fprintf(stdout, "%s", sbuf_data(req.oldsb));
+        if (value)
+            fprintf(stdout, " -> %s", req.newptr);
+        fprintf(stdout, "\n");
+        fflush(stdout);
+    }
+
+    sbuf_delete(req.oldsb);
+
+    return rc;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct sysctl_oid *oidp;
+    int aflag, dflag, nflag;
+    int rc, status, i, c;
+
+    progname = strrchr(argv[0], '/');
+    progname = progname ? progname + 1 : argv[0];
+
+    aflag = dflag = nflag = 0;
+
+    while (-1 != (c = getopt(argc, argv, "adhn"))) {
+        switch (c) {
+        case 'a':
+            aflag = 1;
+            break;
+
+        case 'd':
+            dflag = 1;
+            break;
+
+        case 'h':
+            help();
+            exit(0);
+
+        case 'n':
+            nflag = 1;
+            break;
+
+        default:
+            usage();
+            exit(EX_USAGE);
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc < 1 && !aflag) {
+        usage();
+        exit(EX_USAGE);
+    }
+
+    pmt_tsc_calibrate();
+    pmt_cpu_model_init();
+    pmt_numa_init();
+
+    if (pmt_module) {
+        rc = pmt_module->evhand(NULL, MOD_LOAD, pmt_module->priv);
+        if (rc) {
+            fprintf(stderr, "%s: unable to load %s: %s\n",
+                    progname, pmt_module->name, strerror(rc));
+            exit(EX_OSERR);
+        }
+    }
+
+    rc = status = 0;
+
+    if (aflag) {
+        for (oidp = pmt_oids; oidp && !rc; oidp = oidp->oid_next)
+            rc = pmt_sysctl(oidp->oid_name, dflag, nflag);
+    }
+
+    for (i = 0; i < argc && !rc; ++i) {
+        rc = pmt_sysctl(argv[i], dflag, nflag);
+
+        /* Regressions don't stop the oids that follow (e.g., results),
+         * but make pmt exit with status 1 so that it can gate a pipeline.
+         */
+        if (rc == PMT_EREGRESS) {
+            status = 1;
+            rc = 0;
+        }
+    }
+
+    if (pmt_module)
+        pmt_module->evhand(NULL, MOD_UNLOAD, pmt_module->priv);
+
+    return rc ? EX_SOFTWARE : status;
+}
@@ -0,0 +1,605 @@
+/*
+ * Copyright (c) 2013,2016-2017 Greg Becker.  All rights reserved.
+ *
+ * Performance test module.
+ *
+ * Userspace shims for the handful of FreeBSD kernel interfaces used by
+ * pmt.c and tests.c, so that the same test loop and test callbacks can
+ * be built and run as an ordinary pthreads program on Linux.
+ */
+
+#ifndef PMT_COMPAT_H
+#define PMT_COMPAT_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <linux/futex.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifndef __aligned
+#define __aligned(x)        __attribute__((__aligned__(x)))
+#endif
+
+#ifndef __always_inline
+#define __always_inline     __inline __attribute__((__always_inline__))
+#endif
+
+#ifndef __compiler_membar
+#define __compiler_membar() __asm __volatile(" " : : : "memory")
+#endif
+
+#ifndef __unused
+#define __unused            __attribute__((__unused__))
+#endif
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE           (4096)
+#endif
+
+#ifndef nitems
+#define nitems(x)           (sizeof((x)) / sizeof((x)[0]))
+#endif
+
+#define CACHE_LINE_SIZE     (64)
+#define MAP_ALIGNED_SUPER   (2ul * 1024 * 1024)
+
+#define hz                  (1000)
+
+
+/* printf() in the kernel goes to the console, so send it to stderr
+ * and leave stdout for the results.
+ */
+#define printf(...)         fprintf(stderr, __VA_ARGS__)
+
+#define strlcpy             pmt_strlcpy
+
+size_t pmt_strlcpy(char *dst, const char *src, size_t dstsz);
+
+
+/* Time stamp counter and CPU model (as in hw.model).
+ */
+extern uint64_t tsc_freq;
+extern char cpu_model[128];
+
+static inline uint64_t
+rdtsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t cnt;
+
+    __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r" (cnt));
+    return cnt;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+#endif
+}
+
+static inline void
+nanotime(struct timespec *ts)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+}
+
+static inline void
+getnanotime(struct timespec *ts)
+{
+    clock_gettime(CLOCK_REALTIME_COARSE, ts);
+}
+
+static inline void
+nanouptime(struct timespec *ts)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+static inline void
+cpu_spinwait(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
+/* Preemption can't be held off in userspace.
+ */
+static inline void
+critical_enter(void)
+{
+}
+
+static inline void
+critical_exit(void)
+{
+}
+
+
+/* Atomics (sequentially consistent, as on x86, unless noted otherwise).
+ */
+static inline void
+atomic_add_long(volatile u_long *p, u_long v)
+{
+    __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST);
+}
+
+static inline void
+atomic_add_acq_long(volatile u_long *p, u_long v)
+{
+    __atomic_fetch_add(p, v, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+atomic_add_rel_long(volatile u_long *p, u_long v)
+{
+    __atomic_fetch_add(p, v, __ATOMIC_RELEASE);
+}
+
+static inline u_long
+atomic_fetchadd_long(volatile u_long *p, u_long v)
+{
+    return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST);
+}
+
+static inline u_int
+atomic_fetchadd_int(volatile u_int *p, u_int v)
+{
+    return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST);
+}
+
+static inline int
+atomic_cmpset_acq_int(volatile u_int *p, u_int old, u_int new)
+{
+    return __atomic_compare_exchange_n(p, &old, new, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE);
+}
+
+static inline u_int
+atomic_swap_int(volatile u_int *p, u_int v)
+{
+    return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+static inline u_long
+atomic_swap_long(volatile u_long *p, u_long v)
+{
+    return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+static inline void
+atomic_thread_fence_acq(void)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+static inline void
+atomic_thread_fence_rel(void)
+{
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline u_int
+atomic_load_acq_int(volatile u_int *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+atomic_store_rel_int(volatile u_int *p, u_int v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static inline int
+atomic_cmpset_long(volatile u_long *p, u_long old, u_long new)
+{
+    return __atomic_compare_exchange_n(p, &old, new, 0,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline int
+atomic_cmpset_acq_long(volatile u_long *p, u_long old, u_long new)
+{
+    return __atomic_compare_exchange_n(p, &old, new, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE);
+}
+
+static inline int
+atomic_cmpset_rel_long(volatile u_long *p, u_long old, u_long new)
+{
+    return __atomic_compare_exchange_n(p, &old, new, 0,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+static inline u_long
+atomic_load_acq_long(volatile u_long *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+atomic_store_rel_long(volatile u_long *p, u_long v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+
+/* cpuset(9)
+ */
+typedef cpu_set_t cpuset_t;
+
+#define MAXCPU              CPU_SETSIZE
+#define _NCPUWORDS          (CPU_SETSIZE / (8 * sizeof(u_long)))
+#define CPUSETBUFSIZ        ((2 + sizeof(long) * 2) * _NCPUWORDS)
+
+#undef CPU_AND
+#define CPU_AND(d, s)       __CPU_OP_S(sizeof(cpuset_t), (d), (d), (s), &)
+#define CPU_COPY(f, t)      (*(t) = *(f))
+#define CPU_EMPTY(p)        (CPU_COUNT(p) == 0)
+
+#define CPU_WHICH_CPUSET    (3)
+
+struct cpuset {
+    cpuset_t    cs_mask;
+};
+
+struct thread {
+    pid_t       td_tid;
+};
+
+struct proc;
+
+struct thread *pmt_curthread(void);
+
+#define curthread           pmt_curthread()
+
+int cpuset_which(int which, id_t id, struct proc **pp, struct thread **tdp,
+                 struct cpuset **setp);
+void cpuset_rel(struct cpuset *set);
+int cpuset_setthread(pid_t tid, cpuset_t *mask);
+char *cpusetobj_strprint(char *buf, const cpuset_t *set);
+int cpusetobj_strscan(cpuset_t *set, const char *buf);
+
+
+/* kthread(9)
+ */
+#define PRI_MIN_KERN        (0)     // SCHED_OTHER, otherwise SCHED_FIFO prio
+
+#define kthread_exit()      pthread_exit(NULL)
+
+
+/* malloc(9) and contigmalloc(9).  Note that malloc() and free() are
+ * the kernel flavors from here on.
+ */
+struct malloc_type {
+    const char *ks_shortdesc;
+};
+
+#define MALLOC_DEFINE(type, shortdesc, longdesc) \
+    struct malloc_type type[1] = { { (shortdesc) } }
+
+#define M_NOWAIT            (0x0001)
+#define M_WAITOK            (0x0002)
+#define M_ZERO              (0x0100)
+
+#define malloc(sz, type, flags)     pmt_malloc((sz), (type), (flags))
+#define free(addr, type)            pmt_free((addr), (type))
+
+void *pmt_malloc(size_t size, struct malloc_type *type, int flags);
+void pmt_free(void *addr, struct malloc_type *type);
+
+void *contigmalloc(u_long size, struct malloc_type *type, int flags,
+                   uint64_t low, uint64_t high, u_long alignment,
+                   uint64_t boundary);
+void contigfree(void *addr, u_long size, struct malloc_type *type);
+
+typedef uint64_t vm_paddr_t;
+typedef uintptr_t vm_offset_t;
+
+
+/* domainset(9), pcpu(9) and vm_phys_domain().  vm_ndomains and each
+ * vCPU's domain come from sysfs.  There are no physical addresses in
+ * userspace, so pmap_kextract() is the identity and vm_phys_domain()
+ * asks Linux which node backs the page.
+ */
+#define MAXMEMDOM                   (64)
+
+#define DOMAINSET_POLICY_ROUNDROBIN (1)
+#define DOMAINSET_POLICY_PREFER     (3)
+
+struct domainset {
+    int     ds_policy;
+    int     ds_prefer;
+};
+
+extern struct domainset domainset_prefer[MAXMEMDOM];
+extern struct domainset domainset_roundrobin;
+
+#define DOMAINSET_PREF(domain)      (&domainset_prefer[(domain)])
+#define DOMAINSET_RR()              (&domainset_roundrobin)
+
+struct pcpu {
+    int     pc_domain;
+};
+
+extern int vm_ndomains;
+
+struct pcpu *pcpu_find(u_int cpuid);
+
+void *contigmalloc_domainset(u_long size, struct malloc_type *type,
+                             struct domainset *ds, int flags,
+                             vm_paddr_t low, vm_paddr_t high,
+                             u_long alignment, vm_paddr_t boundary);
+
+#define pmap_kextract(va)           ((vm_paddr_t)(va))
+
+int vm_phys_domain(vm_paddr_t pa);
+
+
+/* CPU topology (see smp(4)), built from sysfs as a tree of packages of
+ * cores of SMT threads.
+ */
+#define CG_SHARE_NONE       (0)
+#define CG_SHARE_L1         (1)
+#define CG_SHARE_L2         (2)
+#define CG_SHARE_L3         (3)
+
+#define CG_FLAG_SMT         (0x08)
+
+struct cpu_group {
+    struct cpu_group   *cg_parent;
+    struct cpu_group   *cg_child;
+    cpuset_t            cg_mask;
+    int32_t             cg_count;
+    int16_t             cg_children;
+    int8_t              cg_level;
+    int8_t              cg_flags;
+};
+
+struct cpu_group *smp_topo(void);
+
+
+/* mutex(9), condvar(9), rwlock(9), sx(9) and rmlock(9).
+ */
+#define MTX_DEF             (0x0000)
+#define MTX_SPIN            (0x0001)
+#define MTX_QUIET           (0x0000)
+
+struct mtx {
+    int     mtx_spin;
+    union {
+        pthread_mutex_t     mtx_mutex;
+        pthread_spinlock_t  mtx_spinlock;
+    };
+};
+
+static inline void
+mtx_init(struct mtx *m, const char *name, const char *type, int opts)
+{
+    m->mtx_spin = (opts & MTX_SPIN);
+
+    if (m->mtx_spin)
+        pthread_spin_init(&m->mtx_spinlock, PTHREAD_PROCESS_PRIVATE);
+    else
+        pthread_mutex_init(&m->mtx_mutex, NULL);
+}
+
+static inline void
+mtx_destroy(struct mtx *m)
+{
+    if (m->mtx_spin)
+        pthread_spin_destroy(&m->mtx_spinlock);
+    else
+        pthread_mutex_destroy(&m->mtx_mutex);
+}
+
+#define mtx_lock(m)                 pthread_mutex_lock(&(m)->mtx_mutex)
+#define mtx_lock_flags(m, f)        pthread_mutex_lock(&(m)->mtx_mutex)
+#define mtx_unlock(m)               pthread_mutex_unlock(&(m)->mtx_mutex)
+#define mtx_lock_spin(m)            pthread_spin_lock(&(m)->mtx_spinlock)
+#define mtx_lock_spin_flags(m, f)   pthread_spin_lock(&(m)->mtx_spinlock)
+#define mtx_unlock_spin(m)          pthread_spin_unlock(&(m)->mtx_spinlock)
+
+struct cv {
+    pthread_cond_t  cv_cond;
+};
+
+#define cv_init(c, desc)        pthread_cond_init(&(c)->cv_cond, NULL)
+#define cv_destroy(c)           pthread_cond_destroy(&(c)->cv_cond)
+#define cv_broadcast(c)         pthread_cond_broadcast(&(c)->cv_cond)
+#define cv_wait(c, m)           pthread_cond_wait(&(c)->cv_cond, &(m)->mtx_mutex)
+#define cv_wait_sig(c, m)       pthread_cond_wait(&(c)->cv_cond, &(m)->mtx_mutex)
+#define cv_timedwait_sig(c, m, timo)    pmt_cv_timedwait((c), (m), (timo))
+
+int pmt_cv_timedwait(struct cv *cv, struct mtx *m, int timo);
+
+#define cv_wait_unlock(c, m)                \
+    do {                                    \
+        cv_wait((c), (m));                  \
+        mtx_unlock((m));                    \
+    } while (0)
+
+int msleep(void *chan, struct mtx *m, int pri, const char *wmesg, int timo);
+
+struct rwlock {
+    pthread_rwlock_t    rw_lock;
+};
+
+#define rw_init(rw, name)       pthread_rwlock_init(&(rw)->rw_lock, NULL)
+#define rw_destroy(rw)          pthread_rwlock_destroy(&(rw)->rw_lock)
+#define rw_rlock(rw)            pthread_rwlock_rdlock(&(rw)->rw_lock)
+#define rw_runlock(rw)          pthread_rwlock_unlock(&(rw)->rw_lock)
+#define rw_wlock(rw)            pthread_rwlock_wrlock(&(rw)->rw_lock)
+#define rw_wunlock(rw)          pthread_rwlock_unlock(&(rw)->rw_lock)
+
+struct sx {
+    pthread_rwlock_t    sx_lock;
+};
+
+#define sx_init(sx, name)       pthread_rwlock_init(&(sx)->sx_lock, NULL)
+#define sx_destroy(sx)          pthread_rwlock_destroy(&(sx)->sx_lock)
+#define sx_slock(sx)            pthread_rwlock_rdlock(&(sx)->sx_lock)
+#define sx_sunlock(sx)          pthread_rwlock_unlock(&(sx)->sx_lock)
+#define sx_xlock(sx)            pthread_rwlock_wrlock(&(sx)->sx_lock)
+#define sx_xunlock(sx)          pthread_rwlock_unlock(&(sx)->sx_lock)
+
+/* There is no userspace read-mostly lock, so an rmlock is simply
+ * an rwlock (which glibc biases toward readers by default).
+ */
+struct rmlock {
+    pthread_rwlock_t    rm_lock;
+};
+
+struct rm_priotracker {
+    int     rmp_unused;
+};
+
+#define rm_init(rm, name)       pthread_rwlock_init(&(rm)->rm_lock, NULL)
+#define rm_destroy(rm)          pthread_rwlock_destroy(&(rm)->rm_lock)
+#define rm_rlock(rm, t)         ((void)(t), pthread_rwlock_rdlock(&(rm)->rm_lock))
+#define rm_runlock(rm, t)       ((void)(t), pthread_rwlock_unlock(&(rm)->rm_lock))
+#define rm_wlock(rm)            pthread_rwlock_wrlock(&(rm)->rm_lock)
+#define rm_wunlock(rm)          pthread_rwlock_unlock(&(rm)->rm_lock)
+
+
+/* sbuf(9)
+ */
+struct sbuf;
+
+struct sbuf *sbuf_new_auto(void);
+void sbuf_clear(struct sbuf *sb);
+int sbuf_cat(struct sbuf *sb, const char *str);
+int sbuf_printf(struct sbuf *sb, const char *fmt, ...)
+    __attribute__((__format__(__printf__, 2, 3)));
+int sbuf_finish(struct sbuf *sb);
+char *sbuf_data(struct sbuf *sb);
+ssize_t sbuf_len(struct sbuf *sb);
+void sbuf_delete(struct sbuf *sb);
+
+
+/* sysctl(9).  Each oid declared via the SYSCTL_*() macros registers
+ * itself at startup so that main() can get and set it by name in
+ * the same manner as sysctl(8).
+ */
+struct sysctl_oid;
+
+struct sysctl_req {
+    struct sbuf *oldsb;         // Receives the current value (if not NULL)
+    const char  *newptr;        // New value to set (if not NULL)
+    size_t       newlen;
+};
+
+#define SYSCTL_HANDLER_ARGS \
+    struct sysctl_oid *oidp, void *arg1, intmax_t arg2, struct sysctl_req *req
+
+typedef int sysctl_handler_t(SYSCTL_HANDLER_ARGS);
+
+struct sysctl_oid {
+    const char          *oid_name;
+    sysctl_handler_t    *oid_handler;
+    void                *oid_arg1;
+    intmax_t             oid_arg2;
+    const char          *oid_fmt;
+    const char          *oid_descr;
+    struct sysctl_oid   *oid_next;
+};
+
+void sysctl_register_oid(struct sysctl_oid *oidp);
+
+/* SYSCTL_OUT() and SYSCTL_IN() handle only text (the old value is cut
+ * at the first NUL).
+ */
+int sysctl_out(struct sysctl_req *req, const void *p, size_t l);
+int sysctl_in(struct sysctl_req *req, void *p, size_t l);
+
+#define SYSCTL_OUT(r, p, l) sysctl_out((r), (p), (l))
+#define SYSCTL_IN(r, p, l)  sysctl_in((r), (p), (l))
+
+sysctl_handler_t sysctl_handle_string;
+sysctl_handler_t sysctl_handle_uint;
+sysctl_handler_t sysctl_handle_64;
+
+#define OID_AUTO            (-1)
+#define CTLFLAG_RD          (0x80000000)
+#define CTLFLAG_WR          (0x40000000)
+#define CTLFLAG_RW          (CTLFLAG_RD | CTLFLAG_WR)
+#define CTLTYPE_STRING      (3)
+#define CTLTYPE_U64         (14)
+
+#define PMT_SYSCTL_OID(name, handler, arg1, arg2, fmt, descr)           \
+    static struct sysctl_oid sysctl___debug_pmt_##name = {              \
+        #name, (handler), (arg1), (arg2), (fmt), (descr), NULL          \
+    };                                                                  \
+                                                                        \
+    static void __attribute__((__constructor__))                        \
+    sysctl___debug_pmt_##name##_init(void)                              \
+    {                                                                   \
+        sysctl_register_oid(&sysctl___debug_pmt_##name);                \
+    }
+
+#define SYSCTL_NODE(parent, nbr, name, access, handler, descr) \
+    struct __hack
+
+#define SYSCTL_UINT(parent, nbr, name, access, ptr, val, descr) \
+    PMT_SYSCTL_OID(name, sysctl_handle_uint, (ptr), (val), "IU", (descr))
+
+#define SYSCTL_U64(parent, nbr, name, access, ptr, val, descr) \
+    PMT_SYSCTL_OID(name, sysctl_handle_64, (ptr), (val), "QU", (descr))
+
+#define SYSCTL_PROC(parent, nbr, name, access, ptr, arg, handler, fmt, descr) \
+    PMT_SYSCTL_OID(name, (handler), (ptr), (arg), (fmt), (descr))
+
+
+/* module(9).  The module event handler is called with MOD_LOAD
+ * at startup and MOD_UNLOAD at exit.
+ */
+typedef struct module *module_t;
+
+typedef int (*modeventhand_t)(module_t, int, void *);
+
+typedef struct moduledata {
+    const char      *name;
+    modeventhand_t   evhand;
+    void            *priv;
+} moduledata_t;
+
+#define MOD_LOAD            (0)
+#define MOD_UNLOAD          (1)
+
+void pmt_module_register(moduledata_t *mod);
+
+#define DECLARE_MODULE(name, data, sub, order)                          \
+    static void __attribute__((__constructor__))                        \
+    name##_module_init(void)                                            \
+    {                                                                   \
+        pmt_module_register(&(data));                                   \
+    }
+
+#define MODULE_VERSION(module, version) \
+    struct __hack
+
+#endif /* PMT_COMPAT_H */
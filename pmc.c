@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2013,2016-2017 Greg Becker.  All rights reserved.
+ *
+ * Performance test module.
+ *
+ * Hardware performance counters.  Each worker counts only between
+ * pmt_pmc_start() and pmt_pmc_stop(), and in the Linux build only
+ * its own thread.
+ *
+ * hwpmc(4) offers no interface for a kernel module to allocate and
+ * read counters on its own behalf, so the kernel build programs the
+ * Intel architectural counters directly (and refuses to if hwpmc is
+ * loaded).  Each worker is bound to its vCPU, so its counters count
+ * everything that vCPU runs over the sample, interrupts included.
+ * There is no architectural L1D miss event, so those aren't counted.
+ */
+
+#ifdef _KERNEL
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/errno.h>
+#include <sys/pmckern.h>
+#if defined(__amd64__) || defined(__i386__)
+#include <machine/cpufunc.h>
+#include <machine/md_var.h>
+#include <machine/specialreg.h>
+#endif
+#else
+#include "compat.h"
+
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "pmc.h"
+
+
+#ifdef _KERNEL
+
+#if defined(__amd64__) || defined(__i386__)
+
+#define PMT_MSR_PMC0            (0x0c1)     // IA32_PMC0
+#define PMT_MSR_PERFEVTSEL0     (0x186)     // IA32_PERFEVTSEL0
+#define PMT_MSR_FIXED_CTR0      (0x309)     // IA32_FIXED_CTR0
+#define PMT_MSR_FIXED_CTR_CTRL  (0x38d)     // IA32_FIXED_CTR_CTRL
+#define PMT_MSR_GLOBAL_CTRL     (0x38f)     // IA32_PERF_GLOBAL_CTRL
+
+#define PMT_EVTSEL_USR          (1ull << 16)
+#define PMT_EVTSEL_OS           (1ull << 17)
+#define PMT_EVTSEL_INT          (1ull << 20)
+#define PMT_EVTSEL_EN           (1ull << 22)
+
+#define PMT_RDPMC_FIXED         (1u << 30)  // rdpmc index flag of a fixed counter
+
+/* Return the MSR of the counter with the given rdpmc index.
+ */
+static u_int
+pmt_pmc_msr(int idx)
+{
+    if (idx & PMT_RDPMC_FIXED)
+        return PMT_MSR_FIXED_CTR0 + (idx & ~PMT_RDPMC_FIXED);
+
+    return PMT_MSR_PMC0 + idx;
+}
+
+/* Program as many of the counters as possible on the calling thread's
+ * vCPU, all disabled until pmt_pmc_start().  Instructions and cycles
+ * use fixed counters 0 and 1, the other events a general purpose
+ * counter each.  The HITM event is model specific, so it's only
+ * counted if the raw event code hitm (event select | umask << 8) is
+ * given.  Returns 0 if any counter was programmed.
+ */
+int
+pmt_pmc_open(pmt_pmc_t *pmc, uint64_t hitm)
+{
+    struct {
+        int      pmc;
+        uint64_t event;         // Event select | umask << 8
+        u_int    unavail;       // Bit of CPUID.0AH:EBX set if unavailable
+    } gpv[] = {
+        { PMT_PMC_LLC_MISS, 0x412e, 1u << 4 },
+        { PMT_PMC_BR_MISS,  0x00c5, 1u << 6 },
+        { PMT_PMC_HITM,     hitm & 0xffffffff & ~(PMT_EVTSEL_INT | PMT_EVTSEL_EN), 0 },
+    };
+    uint64_t fixed_ctrl = 0;
+    u_int regs[4];
+    u_int ngp, nfixed, gp;
+    int i;
+
+    pmc->mask = 0;
+    pmc->ctrl = 0;
+
+    for (i = 0; i < PMT_PMC_MAX; ++i)
+        pmc->idxv[i] = -1;
+
+    if (cpu_vendor_id != CPU_VENDOR_INTEL || cpu_high < 0xa)
+        return EOPNOTSUPP;
+
+    /* Don't pull the counters out from under hwpmc(4).
+     */
+    if (pmc_hook)
+        return EBUSY;
+
+    /* Global control of the counters needs version 2.
+     */
+    do_cpuid(0xa, regs);
+    if ((regs[0] & 0xff) < 2)
+        return EOPNOTSUPP;
+
+    ngp = (regs[0] >> 8) & 0xff;
+    nfixed = regs[3] & 0x1f;
+
+    wrmsr(PMT_MSR_GLOBAL_CTRL, 0);
+
+    if (nfixed >= 2) {
+        if (!(regs[1] & (1u << 1))) {
+            pmc->idxv[PMT_PMC_INSTR] = PMT_RDPMC_FIXED | 0;
+            fixed_ctrl |= 0x3ull << 0;
+        }
+
+        if (!(regs[1] & (1u << 0))) {
+            pmc->idxv[PMT_PMC_CYCLES] = PMT_RDPMC_FIXED | 1;
+            fixed_ctrl |= 0x3ull << 4;
+        }
+    }
+
+    wrmsr(PMT_MSR_FIXED_CTR_CTRL, fixed_ctrl);
+
+    for (i = gp = 0; i < nitems(gpv) && gp < ngp; ++i) {
+        if ((regs[1] & gpv[i].unavail) || !(gpv[i].event & 0xff))
+            continue;
+
+        wrmsr(PMT_MSR_PERFEVTSEL0 + gp, gpv[i].event |
+              PMT_EVTSEL_USR | PMT_EVTSEL_OS | PMT_EVTSEL_EN);
+        pmc->idxv[gpv[i].pmc] = gp++;
+    }
+
+    for (i = 0; i < PMT_PMC_MAX; ++i) {
+        int idx = pmc->idxv[i];
+
+        if (idx < 0)
+            continue;
+
+        pmc->mask |= 1u << i;
+
+        if (idx & PMT_RDPMC_FIXED)
+            pmc->ctrl |= 1ull << (32 + (idx & ~PMT_RDPMC_FIXED));
+        else
+            pmc->ctrl |= 1ull << idx;
+    }
+
+    return pmc->mask ? 0 : ENOENT;
+}
+
+void
+pmt_pmc_close(pmt_pmc_t *pmc)
+{
+    int i;
+
+    wrmsr(PMT_MSR_GLOBAL_CTRL, 0);
+
+    for (i = 0; i < PMT_PMC_MAX; ++i) {
+        int idx = pmc->idxv[i];
+
+        if (idx >= 0 && !(idx & PMT_RDPMC_FIXED))
+            wrmsr(PMT_MSR_PERFEVTSEL0 + idx, 0);
+        pmc->idxv[i] = -1;
+    }
+
+    if (pmc->mask)
+        wrmsr(PMT_MSR_FIXED_CTR_CTRL, 0);
+
+    pmc->mask = 0;
+    pmc->ctrl = 0;
+}
+
+void
+pmt_pmc_start(pmt_pmc_t *pmc)
+{
+    int i;
+
+    for (i = 0; i < PMT_PMC_MAX; ++i) {
+        if (pmc->idxv[i] >= 0)
+            wrmsr(pmt_pmc_msr(pmc->idxv[i]), 0);
+    }
+
+    wrmsr(PMT_MSR_GLOBAL_CTRL, pmc->ctrl);
+}
+
+void
+pmt_pmc_stop(pmt_pmc_t *pmc, uint64_t *countv)
+{
+    int i;
+
+    wrmsr(PMT_MSR_GLOBAL_CTRL, 0);
+
+    for (i = 0; i < PMT_PMC_MAX; ++i)
+        countv[i] = (pmc->idxv[i] >= 0) ? rdpmc(pmc->idxv[i]) : 0;
+}
+
+#else /* __amd64__ || __i386__ */
+
+int
+pmt_pmc_open(pmt_pmc_t *pmc, uint64_t hitm)
+{
+    pmc->mask = 0;
+
+    return EOPNOTSUPP;
+}
+
+void
+pmt_pmc_close(pmt_pmc_t *pmc)
+{
+}
+
+void
+pmt_pmc_start(pmt_pmc_t *pmc)
+{
+}
+
+void
+pmt_pmc_stop(pmt_pmc_t *pmc, uint64_t *countv)
+{
+    int i;
+
+    for (i = 0; i < PMT_PMC_MAX; ++i)
+        countv[i] = 0;
+}
+
+#endif /* __amd64__ || __i386__ */
+
+#else
+
+#define PMT_PMC_CACHE(cache, op, result) \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+/* Open a perf event counter for the calling thread on whichever CPU it
+ * runs, initially disabled and counting user and kernel time alike.
+ */
+static int
+pmt_pmc_open_event(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+        PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Open as many of the counters as possible for the calling thread.
+ * The HITM event is model specific, so it's only counted if the raw
+ * event code hitm is given.  Returns 0 if any counter was opened.
+ */
+int
+pmt_pmc_open(pmt_pmc_t *pmc, uint64_t hitm)
+{
+    int rc = ENOENT;
+    int i;
+
+    pmc->fdv[PMT_PMC_CYCLES] =
+        pmt_pmc_open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    pmc->fdv[PMT_PMC_INSTR] =
+        pmt_pmc_open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    pmc->fdv[PMT_PMC_L1D_MISS] =
+        pmt_pmc_open_event(PERF_TYPE_HW_CACHE,
+                           PMT_PMC_CACHE(PERF_COUNT_HW_CACHE_L1D,
+                                         PERF_COUNT_HW_CACHE_OP_READ,
+                                         PERF_COUNT_HW_CACHE_RESULT_MISS));
+    pmc->fdv[PMT_PMC_LLC_MISS] =
+        pmt_pmc_open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    pmc->fdv[PMT_PMC_BR_MISS] =
+        pmt_pmc_open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    pmc->fdv[PMT_PMC_HITM] =
+        hitm ? pmt_pmc_open_event(PERF_TYPE_RAW, hitm) : -1;
+
+    pmc->mask = 0;
+
+    for (i = 0; i < PMT_PMC_MAX; ++i) {
+        if (pmc->fdv[i] >= 0) {
+            pmc->mask |= 1u << i;
+            rc = 0;
+        } else if (rc) {
+            rc = errno;
+        }
+    }
+
+    return rc;
+}
+
+void
+pmt_pmc_close(pmt_pmc_t *pmc)
+{
+    int i;
+
+    for (i = 0; i < PMT_PMC_MAX; ++i) {
+        if (pmc->fdv[i] >= 0)
+            close(pmc->fdv[i]);
+        pmc->fdv[i] = -1;
+    }
+
+    pmc->mask = 0;
+}
+
+void
+pmt_pmc_start(pmt_pmc_t *pmc)
+{
+    int i;
+
+    for (i = 0; i < PMT_PMC_MAX; ++i) {
+        if (pmc->fdv[i] >= 0) {
+            ioctl(pmc->fdv[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(pmc->fdv[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+/* Stop the counters and retrieve their counts, scaled up to make up
+ * for any time a counter was multiplexed out.
+ */
+void
+pmt_pmc_stop(pmt_pmc_t *pmc, uint64_t *countv)
+{
+    uint64_t valv[3];   // value, time enabled, time running
+    int i;
+
+    for (i = 0; i < PMT_PMC_MAX; ++i) {
+        if (pmc->fdv[i] >= 0)
+            ioctl(pmc->fdv[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    for (i = 0; i < PMT_PMC_MAX; ++i) {
+        countv[i] = 0;
+
+        if (pmc->fdv[i] < 0)
+            continue;
+
+        if (read(pmc->fdv[i], valv, sizeof(valv)) != sizeof(valv))
+            continue;
+
+        if (valv[2] > 0 && valv[2] < valv[1])
+            valv[0] = (uint64_t)(((unsigned __int128)valv[0] * valv[1]) / valv[2]);
+
+        countv[i] = valv[0];
+    }
+}
+
+#endif /* _KERNEL */
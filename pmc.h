@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2013,2016-2017 Greg Becker.  All rights reserved.
+ *
+ * Performance test module.
+ */
+
+#ifndef PMT_PMC_H
+#define PMT_PMC_H
+
+/* Hardware performance counters counted by each worker over the
+ * measured loop of each sample.
+ */
+#define PMT_PMC_CYCLES      (0)     // Core clock cycles
+#define PMT_PMC_INSTR       (1)     // Instructions retired
+#define PMT_PMC_L1D_MISS    (2)     // L1 data cache read misses
+#define PMT_PMC_LLC_MISS    (3)     // Last level cache misses
+#define PMT_PMC_BR_MISS     (4)     // Mispredicted branches
+#define PMT_PMC_HITM        (5)     // Loads that hit modified lines in another core (raw event)
+#define PMT_PMC_MAX         (6)
+
+/* Per-worker counter state.  A counter that couldn't be opened has
+ * its bit clear in mask.
+ */
+typedef struct {
+#ifdef _KERNEL
+    int      idxv[PMT_PMC_MAX]; // rdpmc index of each counter (or -1)
+    uint64_t ctrl;              // Our counters' IA32_PERF_GLOBAL_CTRL enable bits
+#else
+    int      fdv[PMT_PMC_MAX];  // perf event fd of each counter (or -1)
+#endif
+    u_int    mask;
+} pmt_pmc_t;
+
+int pmt_pmc_open(pmt_pmc_t *pmc, uint64_t hitm);
+void pmt_pmc_close(pmt_pmc_t *pmc);
+void pmt_pmc_start(pmt_pmc_t *pmc);
+void pmt_pmc_stop(pmt_pmc_t *pmc, uint64_t *countv);
+
+#endif /* PMT_PMC_H */
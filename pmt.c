@@ -4,8 +4,10 @@
  * Performance test module.
  */
 
+#ifdef _KERNEL
 #include <sys/param.h>
 #include <sys/limits.h>
+#include <sys/stdint.h>
 #include <sys/systm.h>
 #include <sys/kernel.h>
 #include <sys/kthread.h>
@@ -27,13 +29,34 @@
 #include <sys/sbuf.h>
 #include <sys/mman.h>
 #include <sys/module.h>
+#include <sys/domainset.h>
+#include <sys/pcpu.h>
+#include <vm/vm.h>
+#include <vm/pmap.h>
+#include <vm/vm_phys.h>
+#include <machine/cpu.h>
+#include <machine/md_var.h>
+#else
+#include "compat.h"
+#endif
 
 #include "pmt.h"
 #include "tests.h"
+#include "stats.h"
+#include "pmc.h"
 
 #define PMT_TSC         // Use time stamp counter
-//#define PMT_BEFORE
-//#define PMT_AFTER
+#define PMT_ITERS_MAX   (1ul << 40)     // Max calibrated iterations per worker
+#define PMT_PRIV_THINK  roundup(sizeof(pmt_priv_t), CACHE_LINE_SIZE) // Offset of think_buf
+#define PMT_PRIV_SIZE   roundup(PMT_PRIV_THINK + PMT_WORK_MAX, PAGE_SIZE)
+#define PMT_OFFSETS_MAX (64)            // Max offsets in debug.pmt.offsets
+#define PMT_ROLES_MAX   (16)            // Max roles in debug.pmt.roles
+#define PMT_SWEEP_MAX   (16)            // Max thread counts per scaling curve
+#define PMT_BASELINES_MAX   (8)         // Max number of named baselines
+#define PMT_HANDOFF_WAIT    (20000)     // ns the handoff test waits for its waiter to sleep
+#define PMT_DOMAIN_LOCAL        (0)     // Shared data on the first vCPU's domain
+#define PMT_DOMAIN_REMOTE       (1)     // Shared data on the next domain over
+#define PMT_DOMAIN_INTERLEAVE   (2)     // Shared data pages spread over all domains
 
 extern uint64_t tsc_freq;
 
@@ -41,13 +64,41 @@ static unsigned int pmt_pri = PRI_MIN_KERN;
 static unsigned int pmt_verbosity = 1;
 static unsigned int pmt_samples_step = CACHE_LINE_SIZE;
 static unsigned int pmt_samples = 5;
+static unsigned int pmt_samples_max = 128;
+static unsigned int pmt_outlier_mad = 0;
+static unsigned int pmt_ci_target = 0;
 static unsigned int pmt_iters = 16 * 1000 * 1000;
+static unsigned int pmt_duration = 0;
+static unsigned int pmt_timed = 0;
+static unsigned int pmt_skew_max = 0;
+static unsigned int pmt_pervcpu = 0;
+static unsigned int pmt_shr_domain = PMT_DOMAIN_LOCAL;
+static unsigned int pmt_pmc = 0;
+static unsigned int pmt_c2c_iters = 100 * 1000;
+static unsigned int pmt_spin_budget = 100;
+static unsigned int pmt_pause_cycles = 0;
+static unsigned int pmt_threshold = 50;
+static unsigned int pmt_alpha = 500;
+static unsigned int pmt_regressions = 0;
+static uint64_t pmt_chase_max = 64 * 1024 * 1024;
+static uint64_t pmt_stream_size = 8 * 1024 * 1024;
+static uint64_t pmt_pmc_hitm = 0;
 static uint64_t pmt_roundup = 2 * 1024 * 1024;
 static uint64_t pmt_align = MAP_ALIGNED_SUPER;
-static char pmt_results[2048];
-static char pmt_tests[1024];
+static char *pmt_results;
+static char pmt_format[8] = "text";
+static char pmt_tests[2048];
+static char pmt_offsets[256];
+static char pmt_roles[256];
+static char pmt_sweep[64];
+static char pmt_work[256];
+static char pmt_compare[32];
+static char pmt_thresholds[256];
+static u_long pmt_pause_x1000;  // Cycles per 1000 pause loops of this run
+static const char *pmt_sweep_policy;   // Sweep ordering of this run (or NULL)
 
 static char pmt_cpustr[CPUSETBUFSIZ];
+static char pmt_cpumask[MAXCPU / 4 + 1];
 static cpuset_t pmt_cpuset;
 
 
@@ -55,18 +106,136 @@ typedef struct {
     pmt_test_cb_t   *every;     // Func to call on every iteration
     pmt_test_cb_t   *before;    // Func to call once before every()
     pmt_test_cb_t   *after;     // Func to call once after every()
+    pmt_test_loop_t *loop;      // Specialized loop with the test inlined
+    size_t           wss;       // Pointer chase working set size (bytes)
+    u_int            bytes;     // Bytes moved per call by a stream test
+    u_int            stride;    // Bytes between the workers' stride counters
+    u_int            write_ppm; // Write fraction of a mixed test (per million)
+    int              roles;     // Run the tests given by debug.pmt.roles
+    int              work;      // Takes lock work parameters from debug.pmt.work
+    u_int            cs_cycles; // Cycles of spinning per call while holding the lock
+    u_int            cs_bytes;  // Bytes of shared data touched per call while holding the lock
+    u_int            think_cycles;  // Cycles of spinning per call between acquisitions
+    u_int            think_bytes;   // Bytes of private data touched per call between acquisitions
     const char      *help;
     const char      *name;
 } pmt_test_t;
 
+/* A role from debug.pmt.roles:  The test to run on each of the given
+ * vCPUs during the "roles" test.
+ */
+typedef struct {
+    pmt_test_t      *test;
+    char             vcpus[32]; // List of vCPUs and vCPU ranges (e.g., "1-3,5")
+} pmt_role_t;
+
+/* Per-worker results of one sample.
+ */
+typedef struct {
+    unsigned long delta;        // Worker time (stop - start) in cycles or nsecs.
+    unsigned long iters;        // Worker iterations
+    uint64_t pmcv[PMT_PMC_MAX]; // Worker hardware counter counts
+} pmt_wsample_t;
+
+/* Hardware counter totals of the accepted samples of one test.
+ */
+typedef struct {
+    unsigned long iters;        // Total iterations of all workers
+    uint64_t countv[PMT_PMC_MAX];
+} pmt_pmcres_t;
+
 typedef struct {
     unsigned long delta;        // Sample time (stop - start) in cycles or nsecs.
     unsigned long iters;        // Sample iterations
+    pmt_wsample_t *workerv;     // Per-worker results (one for each pool worker)
+    unsigned long start_skew;   // Latest minus earliest worker start time
+    unsigned long stop_skew;    // Latest minus earliest worker stop time
+    int           rejected;     // Start skew exceeded pmt_skew_max
+    int           outlier;      // Rejected as an outlier by pmt_evaluate()
+    int           domain;       // NUMA domain of the sample's shared data
+    unsigned long handoffs;     // Lock handoffs measured by all workers
+    uint64_t      handoff_cycles;   // TSC cycles from release to acquire of those
+    unsigned long handoff_nosleep;  // Lock handoffs not measured (waiter never slept)
+    unsigned long reads;        // Mixed test reads of all workers
+    unsigned long writes;       // Mixed test writes of all workers
+    uint64_t      read_cycles;  // TSC cycles spent in those reads
+    uint64_t      write_cycles; // TSC cycles spent in those writes
 } pmt_sample_t;
 
+/* Fairness of the per-worker throughput, each scaled by 1000.
+ */
+typedef struct {
+    u_long  minmax;             // Ratio of the min to the max throughput
+    u_long  cv;                 // Coefficient of variation
+    u_long  jain;               // Jain's fairness index
+} pmt_fair_t;
+
+/* A sense-reversing spin barrier.
+ */
+typedef struct {
+    volatile u_int  count;      // Number of workers yet to arrive
+    volatile u_int  sense;      // Flipped by the last worker to arrive
+    u_int           nworkers;
+} pmt_barrier_t;
+
+struct pmt_pool_s;
 
-static int pmt_run(pmt_test_t *ptest, void *mem, size_t memsz,
-                   int samplesc, pmt_sample_t *samplesv);
+/* Per-worker thread pool data.
+ */
+typedef struct {
+    struct pmt_pool_s *pool;
+    pmt_priv_t *priv;           // Private data, allocated on vcpu's domain
+    pmt_test_t *test;           // Test to run in place of the "roles" test
+    int         role;           // Index of this worker's role (or -1)
+    cpuset_t    vcpu_mask;      // The vCPU to which this worker is affined
+    int         vcpu;
+    int         domain;         // NUMA domain of vcpu
+    int         priv_domain;    // NUMA domain on which priv landed
+    pmt_pmc_t   pmc;            // Hardware counters (if pool->pmc)
+    int         pmc_rc;         // Result of opening the counters
+    uint64_t    pmcv[PMT_PMC_MAX];  // Counts from the last sample
+    int         rc;             // Result of affining to vcpu_mask
+    u_int       sense;          // This worker's barrier sense
+    int         selected;       // Runs the samples (see pmt_pool_select())
+} pmt_worker_t;
+
+/* The worker thread pool.  One worker is created and affined to each
+ * vCPU at the start of a debug.pmt.run invocation, and then parks
+ * between samples until pmt_run() hands it the next sample to run.
+ */
+typedef struct pmt_pool_s {
+    struct mtx      mtx;
+    struct cv       cv;         // Workers wait here for the next sample
+    struct cv       donecv;     // pmt_run() waits here for the workers
+    u_int           gen;        // Incremented to start each sample
+    u_int           nready;     // Number of workers affined and parked
+    u_int           ndone;      // Number of workers done with the sample
+    u_int           nexited;    // Number of workers that have exited
+    int             exiting;    // Set to tell all workers to exit
+    pmt_share_t    *shr;        // Shared data for the current sample
+    u_long          iters;      // Iterations per worker (0 to run until stopped)
+    u_int           nworkers;
+    u_int           nrun;       // Number of workers selected to run samples
+    pmt_worker_t  **runv;       // The selected workers, in vCPU order
+    int             pmc;        // Count hardware events
+    void           *wsbase;     // Region for the chase and stream tests (if any)
+    ssize_t         shroff;     // Offset of the shared data of all samples (if >= 0)
+
+    __aligned(CACHE_LINE_SIZE)
+    volatile u_int  stop;       // Set to stop workers when iters is 0
+
+    __aligned(CACHE_LINE_SIZE)
+    pmt_barrier_t   barrier;    // Start line for each sample
+    pmt_worker_t    workerv[];
+} pmt_pool_t;
+
+
+static int pmt_run(pmt_test_t *ptest, pmt_pool_t *pool, void *mem, size_t memsz,
+                   int first, int last, u_long iters, pmt_sample_t *samplesv);
+
+static int pmt_pool_create(cpuset_t *cpuset, pmt_pool_t **poolp);
+static void pmt_pool_select(pmt_pool_t *pool, const cpuset_t *set);
+static void pmt_pool_destroy(pmt_pool_t *pool);
 
 static int pmt_kthread_create(void (*func)(void *), void *arg, const char *name);
 
@@ -98,11 +267,97 @@ SYSCTL_UINT(_debug_pmt, OID_AUTO, iter,
             &pmt_iters, 0,
             "Number of iterations per thread per test loop iteration");
 
+SYSCTL_UINT(_debug_pmt, OID_AUTO, duration,
+            CTLFLAG_RW,
+            &pmt_duration, 0,
+            "Calibrate iterations so that each sample takes this many milliseconds (0 uses iter)");
+
+SYSCTL_UINT(_debug_pmt, OID_AUTO, timed,
+            CTLFLAG_RW,
+            &pmt_timed, 0,
+            "Run each sample for exactly duration milliseconds rather than calibrating");
+
 SYSCTL_UINT(_debug_pmt, OID_AUTO, samples,
             CTLFLAG_RW,
             &pmt_samples, 0,
             "Number of samples per test");
 
+SYSCTL_UINT(_debug_pmt, OID_AUTO, samples_max,
+            CTLFLAG_RW,
+            &pmt_samples_max, 0,
+            "Max number of samples per test when ci_target is set");
+
+SYSCTL_UINT(_debug_pmt, OID_AUTO, outlier_mad,
+            CTLFLAG_RW,
+            &pmt_outlier_mad, 0,
+            "Reject samples more than this many tenths of a MAD from the median (0 disables)");
+
+SYSCTL_UINT(_debug_pmt, OID_AUTO, ci_target,
+            CTLFLAG_RW,
+            &pmt_ci_target, 0,
+            "Sample until the 95% CI is within this many tenths of a percent of the mean (0 disables)");
+
+SYSCTL_UINT(_debug_pmt, OID_AUTO, skew_max,
+            CTLFLAG_RW,
+            &pmt_skew_max, 0,
+            "Reject samples whose start skew exceeds this percent of the sample time (0 disables)");
+
+SYSCTL_UINT(_debug_pmt, OID_AUTO, pervcpu,
+            CTLFLAG_RW,
+            &pmt_pervcpu, 0,
+            "Show per-vCPU results for each test");
+
+SYSCTL_UINT(_debug_pmt, OID_AUTO, shr_domain,
+            CTLFLAG_RW,
+            &pmt_shr_domain, 0,
+            "NUMA placement of the shared data (0: local, 1: remote, 2: interleave)");
+
+SYSCTL_UINT(_debug_pmt, OID_AUTO, pmc,
+            CTLFLAG_RW,
+            &pmt_pmc, 0,
+            "Count hardware events (instructions, cache misses, ...) for each test");
+
+SYSCTL_U64(_debug_pmt, OID_AUTO, pmc_hitm,
+           CTLFLAG_RW,
+           &pmt_pmc_hitm, 0,
+           "Raw, model specific event code that counts HITM snoops (0 to not count)");
+
+SYSCTL_UINT(_debug_pmt, OID_AUTO, c2c_iter,
+            CTLFLAG_RW,
+            &pmt_c2c_iters, 0,
+            "Number of round trips per sample of each vCPU pair by debug.pmt.c2c");
+
+SYSCTL_UINT(_debug_pmt, OID_AUTO, spin_budget,
+            CTLFLAG_RW,
+            &pmt_spin_budget, 0,
+            "Number of times the adaptive lock spins on a held lock before parking");
+
+SYSCTL_UINT(_debug_pmt, OID_AUTO, pause_cycles,
+            CTLFLAG_RW,
+            &pmt_pause_cycles, 0,
+            "Cycles per 1000 pause loops of lock test work (0 to calibrate each run)");
+
+SYSCTL_UINT(_debug_pmt, OID_AUTO, threshold,
+            CTLFLAG_RW,
+            &pmt_threshold, 0,
+            "Change in median cost per call (per mille) that debug.pmt.compare flags");
+
+SYSCTL_UINT(_debug_pmt, OID_AUTO, alpha,
+            CTLFLAG_RW,
+            &pmt_alpha, 0,
+            "Significance level (per 10000) of debug.pmt.compare's Mann-Whitney U test");
+
+SYSCTL_UINT(_debug_pmt, OID_AUTO, regressions,
+            CTLFLAG_RD,
+            &pmt_regressions, 0,
+            "Number of regressions found by the last debug.pmt.compare");
+
+SYSCTL_U64(_debug_pmt, OID_AUTO, chase_max,
+           CTLFLAG_RW,
+           &pmt_chase_max, 0,
+           "Skip pointer chase tests whose working set exceeds this many bytes");
+
+
 SYSCTL_U64(_debug_pmt, OID_AUTO, roundup,
            CTLFLAG_RW,
            &pmt_roundup, 0,
@@ -114,6 +369,62 @@ SYSCTL_U64(_debug_pmt, OID_AUTO, align,
            "Test memory allocation alignmentment");
 
 
+/* Define a test that runs the loop generated by PMT_TEST_DEFINE(base).
+ */
+#define PMT_TEST_INLINE(tname, base)                \
+    { .name = tname "-inline",                      \
+      .help = "inlined, unrolled " tname,           \
+      .loop = base##_loop,                          \
+    }
+
+/* Define an inlined lock test that takes the work parameters given
+ * by debug.pmt.work.
+ */
+#define PMT_TEST_INLINE_WORK(tname, base)           \
+    { .name = tname "-inline",                      \
+      .help = "inlined, unrolled " tname,           \
+      .loop = base##_loop,                          \
+      .work = 1,                                    \
+    }
+
+/* Define a pointer chase test over a working set of wss bytes.
+ */
+#define PMT_TEST_CHASE(tname, wss_)                 \
+    { .name = "chase-" tname,                       \
+      .help = "chase pointers through a random " tname " working set", \
+      .loop = pmt_chase_loop,                       \
+      .wss = (wss_),                                \
+    }
+
+/* Define a stream test that moves bytes_ bytes per call.
+ */
+#define PMT_TEST_STREAM(tname, base, bytes_)        \
+    { .name = "stream-" tname,                      \
+      .help = "STREAM " tname " bandwidth",         \
+      .loop = base##_loop,                          \
+      .bytes = (bytes_),                            \
+    }
+
+/* Define a per-cpu counter test with the workers' counters stride_
+ * bytes apart.
+ */
+#define PMT_TEST_STRIDE(tname, stride_)             \
+    { .name = "stride-" tname,                      \
+      .help = "increment per-cpu counters " tname " bytes apart", \
+      .loop = pmt_inc_stride_loop,                  \
+      .stride = (stride_),                          \
+    }
+
+/* Define a test that mixes read and write locking, writing on ppm_
+ * calls per million.
+ */
+#define PMT_TEST_MIX(tname, base, pct, ppm_)        \
+    { .name = tname "-mix-" pct,                    \
+      .help = tname " read locks mixed with " pct " write locks", \
+      .loop = base##_loop,                          \
+      .write_ppm = (ppm_),                          \
+    }
+
 static pmt_test_t tests[] = {
     { .name = "null",
       .help = "pmt framework overhead",
@@ -152,41 +463,49 @@ static pmt_test_t tests[] = {
     { .name = "rm_rlock",
       .help = "use a shared rm read lock to increment a per-cpu counter",
       .every = pmt_rm_rlock_every,
+      .work = 1,
     },
 
     { .name = "rm_wlock",
       .help = "use a shared rm write lock to increment a shared counter",
       .every = pmt_rm_wlock_every,
+      .work = 1,
     },
 
     { .name = "sx_slock",
       .help = "use a shared sx shared lock to per-cpu counter",
       .every = pmt_sx_slock_every,
+      .work = 1,
     },
 
     { .name = "sx_xlock",
       .help = "use a shared sx lock to increment a shared counter",
       .every = pmt_sx_xlock_every,
+      .work = 1,
     },
 
     { .name = "mutex",
       .help = "use a shared mutex to increment a shared counter",
       .every = pmt_mtx_every,
+      .work = 1,
     },
 
     { .name = "spin",
       .help = "use a shared spin mutex to increment a shared counter",
       .every = pmt_mtx_spin_every,
+      .work = 1,
     },
 
     { .name = "rw_rlock",
       .help = "use a shared rw read lock to increment a per-cpu counter",
       .every = pmt_rw_rlock_every,
+      .work = 1,
     },
 
     { .name = "rw_wlock",
       .help = "use a shared rw write lock to increment a shared counter",
       .every = pmt_rw_wlock_every,
+      .work = 1,
     },
 
     { .name = "rw_rlock+atomic_add_long",
@@ -194,6 +513,61 @@ static pmt_test_t tests[] = {
       .every = pmt_rw_rlock_atomic_add_every,
     },
 
+    { .name = "tas_lock",
+      .help = "use a shared test-and-set spinlock to increment a shared counter",
+      .every = pmt_tas_lock_every,
+    },
+
+    { .name = "ttas_lock",
+      .help = "use a shared test-and-test-and-set spinlock with backoff to increment a shared counter",
+      .every = pmt_ttas_lock_every,
+    },
+
+    { .name = "ticket_lock",
+      .help = "use a shared ticket spinlock to increment a shared counter",
+      .every = pmt_ticket_lock_every,
+    },
+
+    { .name = "mcs_lock",
+      .help = "use a shared MCS queue spinlock to increment a shared counter",
+      .every = pmt_mcs_lock_every,
+    },
+
+    { .name = "clh_lock",
+      .help = "use a shared CLH queue spinlock to increment a shared counter",
+      .every = pmt_clh_lock_every,
+    },
+
+    { .name = "qspin_lock",
+      .help = "use a shared qspinlock-like queued spinlock to increment a shared counter",
+      .every = pmt_qspin_lock_every,
+    },
+
+    { .name = "adaptive_lock",
+      .help = "use a shared spin-then-park lock to increment a shared counter",
+      .every = pmt_adaptive_lock_every,
+    },
+
+    { .name = "handoff",
+      .help = "hand an adaptive lock from vCPU 0 to a parked vCPU 1",
+      .every = pmt_handoff_every,
+    },
+
+    { .name = "mpmc",
+      .help = "enqueue and dequeue a value on a shared bounded MPMC ring",
+      .every = pmt_mpmc_every,
+    },
+
+    { .name = "spsc",
+      .help = "push (even vCPUs) or pop (odd vCPUs) a value on per-pair SPSC rings",
+      .every = pmt_spsc_every,
+    },
+
+    { .name = "treiber",
+      .help = "pop a node from a shared Treiber stack and push it back",
+      .every = pmt_treiber_every,
+    },
+
     { .name = "getnanotime",
       .help = "call getnanotime",
       .every = pmt_getnanotime_every,
@@ -204,25 +578,124 @@ static pmt_test_t tests[] = {
       .every = pmt_nanotime_every,
     },
 
+    /* The following tests run the same bodies as those above, but
+     * inlined into an unrolled loop rather than called via every().
+     */
+    PMT_TEST_INLINE("inc-shared", pmt_inc_shared),
+    PMT_TEST_INLINE("inc-pcpu", pmt_inc_pcpu),
+    PMT_TEST_INLINE("atomic_add_long", pmt_atomic_add_long),
+    PMT_TEST_INLINE("atomic_fetchadd_long", pmt_atomic_fetchadd_long),
+    PMT_TEST_INLINE("atomic_cmpset_long", pmt_atomic_cmpset_long),
+    PMT_TEST_INLINE_WORK("rm_rlock", pmt_rm_rlock),
+    PMT_TEST_INLINE_WORK("rm_wlock", pmt_rm_wlock),
+    PMT_TEST_INLINE_WORK("sx_slock", pmt_sx_slock),
+    PMT_TEST_INLINE_WORK("sx_xlock", pmt_sx_xlock),
+    PMT_TEST_INLINE_WORK("mutex", pmt_mtx),
+    PMT_TEST_INLINE_WORK("spin", pmt_mtx_spin),
+    PMT_TEST_INLINE_WORK("rw_rlock", pmt_rw_rlock),
+    PMT_TEST_INLINE_WORK("rw_wlock", pmt_rw_wlock),
+    PMT_TEST_INLINE("rw_rlock+atomic_add_long", pmt_rw_rlock_atomic_add),
+    PMT_TEST_INLINE("tas_lock", pmt_tas_lock),
+    PMT_TEST_INLINE("ttas_lock", pmt_ttas_lock),
+    PMT_TEST_INLINE("ticket_lock", pmt_ticket_lock),
+    PMT_TEST_INLINE("mcs_lock", pmt_mcs_lock),
+    PMT_TEST_INLINE("clh_lock", pmt_clh_lock),
+    PMT_TEST_INLINE("qspin_lock", pmt_qspin_lock),
+    PMT_TEST_INLINE("adaptive_lock", pmt_adaptive_lock),
+    PMT_TEST_INLINE("mpmc", pmt_mpmc),
+    PMT_TEST_INLINE("spsc", pmt_spsc),
+    PMT_TEST_INLINE("treiber", pmt_treiber),
+    PMT_TEST_INLINE("getnanotime", pmt_getnanotime),
+    PMT_TEST_INLINE("nanotime", pmt_nanotime),
+
+    /* The pointer chase tests measure the load latency of each level of
+     * the memory hierarchy, subject to debug.pmt.chase_max.
+     */
+    PMT_TEST_CHASE("4k", 4ul << 10),
+    PMT_TEST_CHASE("16k", 16ul << 10),
+    PMT_TEST_CHASE("64k", 64ul << 10),
+    PMT_TEST_CHASE("256k", 256ul << 10),
+    PMT_TEST_CHASE("1m", 1ul << 20),
+    PMT_TEST_CHASE("4m", 4ul << 20),
+    PMT_TEST_CHASE("16m", 16ul << 20),
+    PMT_TEST_CHASE("64m", 64ul << 20),
+    PMT_TEST_CHASE("256m", 256ul << 20),
+    PMT_TEST_CHASE("1g", 1ul << 30),
+    PMT_TEST_CHASE("4g", 4ul << 30),
+
+    /* The stream tests measure memory bandwidth, each worker working on
+     * its own arrays of debug.pmt.stream_size bytes.  The bytes per call
+     * count one cache line of each array read or written.
+     */
+    PMT_TEST_STREAM("copy", pmt_stream_copy, 2 * CACHE_LINE_SIZE),
+    PMT_TEST_STREAM("scale", pmt_stream_scale, 2 * CACHE_LINE_SIZE),
+    PMT_TEST_STREAM("add", pmt_stream_add, 3 * CACHE_LINE_SIZE),
+    PMT_TEST_STREAM("triad", pmt_stream_triad, 3 * CACHE_LINE_SIZE),
+
+    /* The stride tests sweep the spacing of per-cpu counters from all
+     * workers sharing a line through adjacent lines to well apart.
+     */
+    PMT_TEST_STRIDE("8", 8),
+    PMT_TEST_STRIDE("16", 16),
+    PMT_TEST_STRIDE("32", 32),
+    PMT_TEST_STRIDE("64", 64),
+    PMT_TEST_STRIDE("128", 128),
+    PMT_TEST_STRIDE("256", 256),
+
+    /* The mixed tests sweep the write fraction of each of the reader/
+     * writer locks, reporting the costs of the reads and the writes
+     * separately.
+     */
+    PMT_TEST_MIX("rw", pmt_rw_mix, "0.1%", 1000),
+    PMT_TEST_MIX("rw", pmt_rw_mix, "1%", 10000),
+    PMT_TEST_MIX("rw", pmt_rw_mix, "10%", 100000),
+    PMT_TEST_MIX("rw", pmt_rw_mix, "50%", 500000),
+    PMT_TEST_MIX("rm", pmt_rm_mix, "0.1%", 1000),
+    PMT_TEST_MIX("rm", pmt_rm_mix, "1%", 10000),
+    PMT_TEST_MIX("rm", pmt_rm_mix, "10%", 100000),
+    PMT_TEST_MIX("rm", pmt_rm_mix, "50%", 500000),
+    PMT_TEST_MIX("sx", pmt_sx_mix, "0.1%", 1000),
+    PMT_TEST_MIX("sx", pmt_sx_mix, "1%", 10000),
+    PMT_TEST_MIX("sx", pmt_sx_mix, "10%", 100000),
+    PMT_TEST_MIX("sx", pmt_sx_mix, "50%", 500000),
+
+    /* The roles test runs a different test on each group of vCPUs
+     * given by debug.pmt.roles (and nothing on any other vCPUs).
+     */
+    { .name = "roles",
+      .help = "run the tests given by debug.pmt.roles on their vCPUs",
+      .roles = 1,
+    },
+
     { .name = NULL }
 };
 
-/* Compute (x * 1000000000) / y, avoiding overflow even if it means
- * loss of precision.
+/* Compute (x * 1000000000) / y without overflow.
  */
 static u_long
 pmt_x1b_div_y(u_long x, u_long y)
 {
-    if (((x << 30) >> 30) == x)
-        return (x * 1000000000ul) / y;
+    return pmt_muldiv(x, 1000000000ul, y);
+}
 
-    if (((x << 20) >> 20) == x)
-        return (((x * 1000000ul) / y) * 1000);
+/* Format the given cpuset as a hex mask, omitting leading zero words
+ * but showing at least one full word.
+ */
+static void
+pmt_cpuset_hex(char *buf, size_t bufsz, const cpuset_t *set)
+{
+    size_t len = 0;
+    int i;
 
-    if (((x << 10) >> 10) == x)
-        return (((x * 1000ul) / y) * 1000000);
+    for (i = _NCPUWORDS - 1; i > 0; --i) {
+        if (set->__bits[i])
+            break;
+    }
 
-    return ((x / y) * 1000000000ul);
+    for (buf[0] = '\0'; i >= 0 && len < bufsz; --i) {
+        len += snprintf(buf + len, bufsz - len, "%0*lx",
+                        (int)sizeof(set->__bits[i]) * 2, (u_long)set->__bits[i]);
+    }
 }
 
 static u_long
@@ -231,6 +704,168 @@ pmt_cycles2nsecs(u_long cycles)
     return pmt_x1b_div_y(cycles, tsc_freq);
 }
 
+/* Compute the fairness metrics of the given per-worker throughputs.
+ * All three metrics are scale invariant, so each rate is first scaled
+ * relative to the max rate (i.e., to [0, 1M]) in order to keep the sums
+ * of squares in range.
+ */
+static void
+pmt_fairness(const u_long *ratev, int ratec, pmt_fair_t *fair)
+{
+    u_long sum, sumsq, var, min, max, mean;
+    int i;
+
+    memset(fair, 0, sizeof(*fair));
+
+    if (ratec < 1)
+        return;
+
+    max = 0;
+    for (i = 0; i < ratec; ++i)
+        max = MAX(max, ratev[i]);
+
+    if (max < 1)
+        return;
+
+    sum = sumsq = var = 0;
+    min = ULONG_MAX;
+
+    for (i = 0; i < ratec; ++i) {
+        u_long rate = (ratev[i] * 1000000ul) / max;
+
+        sum += rate;
+        sumsq += rate * rate;
+        min = MIN(min, rate);
+    }
+
+    mean = sum / ratec;
+
+    for (i = 0; i < ratec; ++i) {
+        u_long rate = (ratev[i] * 1000000ul) / max;
+        u_long dev = (rate > mean) ? rate - mean : mean - rate;
+
+        var += dev * dev;
+    }
+
+    var /= ratec;
+
+    fair->minmax = min / 1000;
+    if (mean > 0)
+        fair->cv = (pmt_isqrt(var) * 1000) / mean;
+    if (sumsq > 0)
+        fair->jain = ((sum * sum) / ratec * 1000) / sumsq;
+}
+
+/* Return the current time in cycles or nanoseconds.
+ */
+static inline uint64_t
+pmt_now(void)
+{
+#ifdef PMT_TSC
+    return rdtsc();
+#else
+    struct timespec ts;
+
+    nanouptime(&ts);
+
+    return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+#endif
+}
+
+/* Return the size of the stream arrays of one worker, a multiple of the
+ * page size.
+ */
+static size_t
+pmt_stream_slice(void)
+{
+    return roundup(3 * pmt_stream_size, PAGE_SIZE);
+}
+
+/* Return the size of the working set region needed to run the given
+ * test with nworkers workers.
+ */
+static size_t
+pmt_test_wss(const pmt_test_t *test, u_int nworkers)
+{
+    if (test->bytes)
+        return pmt_stream_slice() * nworkers;
+
+    if (test->stride)
+        return roundup(test->stride * nworkers, PAGE_SIZE);
+
+    return test->wss;
+}
+
+/* Link the cache lines of the first wss bytes of base into a single
+ * cycle in random order (via Sattolo's algorithm, in place), so that
+ * following the pointers defeats the hardware prefetchers.  The seed
+ * is fixed so that every run chases the same chain.
+ */
+static void
+pmt_chase_build(void *base, size_t wss)
+{
+    size_t nlines = wss / CACHE_LINE_SIZE;
+    uint64_t seed = 0x9e3779b97f4a7c15ul;
+    size_t i, j, tmp;
+    size_t *linev;
+
+    for (i = 0; i < nlines; ++i) {
+        linev = (size_t *)((char *)base + i * CACHE_LINE_SIZE);
+        *linev = i;
+    }
+
+    for (i = nlines - 1; i > 0; --i) {
+        size_t *ip = (size_t *)((char *)base + i * CACHE_LINE_SIZE);
+        size_t *jp;
+
+        seed ^= seed >> 12;
+        seed ^= seed << 25;
+        seed ^= seed >> 27;
+        j = (seed * 0x2545f4914f6cdd1dul) % i;
+
+        jp = (size_t *)((char *)base + j * CACHE_LINE_SIZE);
+        tmp = *ip;
+        *ip = *jp;
+        *jp = tmp;
+    }
+
+    /* Now turn the successor indices into pointers.
+     */
+    for (i = 0; i < nlines; ++i) {
+        void **chase = (void **)((char *)base + i * CACHE_LINE_SIZE);
+
+        *chase = (char *)base + *(size_t *)chase * CACHE_LINE_SIZE;
+    }
+}
+
+/* Return the NUMA domain of the page backing the given kernel address.
+ */
+static int
+pmt_addr_domain(const void *addr)
+{
+    return vm_phys_domain(pmap_kextract((vm_offset_t)addr));
+}
+
+static u_long
+pmt_delta2nsecs(u_long delta)
+{
+#ifdef PMT_TSC
+    return pmt_cycles2nsecs(delta);
+#else
+    return delta;
+#endif
+}
+
+static u_long
+pmt_nsecs2delta(u_long nsecs)
+{
+#ifdef PMT_TSC
+    return pmt_muldiv(nsecs, tsc_freq, 1000000000ul);
+#else
+    return nsecs;
+#endif
+}
+
 static void
 pmt_tests_reset(void)
 {
@@ -254,194 +889,2929 @@ pmt_tests_reset(void)
     }
 }
 
+/* Return non-zero if the given test name is one of the space separated
+ * names in debug.pmt.tests.
+ */
 static int
-pmt_tests_sysctl(SYSCTL_HANDLER_ARGS)
+pmt_tests_match(const char *name)
 {
-    if (pmt_tests[0] == '\000' || 0 == strcmp(pmt_tests, "all"))
-        pmt_tests_reset();
+    size_t len = strlen(name);
+    char *cur;
+
+    for (cur = pmt_tests; (cur = strstr(cur, name)); cur += len) {
+        if ((cur == pmt_tests || cur[-1] == ' ') &&
+            (cur[len] == ' ' || cur[len] == '\000'))
+            return 1;
+    }
 
-    return sysctl_handle_string(oidp, pmt_tests, sizeof(pmt_tests), req);
+    return 0;
 }
 
-SYSCTL_PROC(_debug_pmt, OID_AUTO, tests,
+static int
+pmt_offsets_sysctl(SYSCTL_HANDLER_ARGS)
+{
+    return sysctl_handle_string(oidp, pmt_offsets, sizeof(pmt_offsets), req);
+}
+
+SYSCTL_PROC(_debug_pmt, OID_AUTO, offsets,
             CTLTYPE_STRING | CTLFLAG_RW,
-            NULL, 0, pmt_tests_sysctl, "A",
-            "List of tests to run");
+            NULL, 0, pmt_offsets_sysctl, "A",
+            "List of byte offsets at which to also run each test (empty to not sweep)");
 
 static int
-pmt_run_sysctl(SYSCTL_HANDLER_ARGS)
+pmt_roles_sysctl(SYSCTL_HANDLER_ARGS)
 {
-    unsigned long cycles_baseline, nsecs_baseline;
-    char cpustr[CPUSETBUFSIZ];
-    pmt_sample_t *samplesv;
-    size_t round, align;
-    struct cpuset *set;
-    struct thread *td;
-    struct proc *proc;
-    pmt_test_t *test;
-    struct sbuf *sb;
-    cpuset_t cpuset;
-    int samplesc;
-    size_t memsz;
-    void *mem;
-    int rc;
+    return sysctl_handle_string(oidp, pmt_roles, sizeof(pmt_roles), req);
+}
 
-    cpusetobj_strprint(cpustr, &pmt_cpuset);
+SYSCTL_PROC(_debug_pmt, OID_AUTO, roles,
+            CTLTYPE_STRING | CTLFLAG_RW,
+            NULL, 0, pmt_roles_sysctl, "A",
+            "vCPUs:test pairs for the roles test (e.g., \"0:rm_wlock 1-15:rm_rlock\")");
 
-    rc = sysctl_handle_string(oidp, cpustr, sizeof(cpustr), req);
+/* vCPU orderings of a thread count sweep.
+ */
+static const char *pmt_sweep_policyv[] = {
+    "smt",          // Fill each core's SMT siblings before the next core
+    "core",         // One thread per core, then the second siblings, ...
+    "spread",       // One thread per core, round robin across packages
+    "compact",      // One thread per core of a package, then its siblings
+};
+
+static int
+pmt_sweep_sysctl(SYSCTL_HANDLER_ARGS)
+{
+    char sweep[sizeof(pmt_sweep)];
+    char *cur, *end;
+    size_t len;
+    int rc, p;
+
+    strlcpy(sweep, pmt_sweep, sizeof(sweep));
+
+    rc = sysctl_handle_string(oidp, sweep, sizeof(sweep), req);
     if (rc || !req->newptr)
         return rc;
 
-    rc = cpusetobj_strscan(&cpuset, cpustr);
-    if (rc)
-        return EINVAL;
+    /* Accept only the names of known orderings.
+     */
+    for (cur = sweep; *cur; cur = end) {
+        while (*cur == ' ')
+            ++cur;
+        if (!*cur)
+            break;
 
-    rc = cpuset_which(CPU_WHICH_CPUSET, -1, &proc, &td, &set);
-    if (rc)
-        return rc;
+        for (end = cur; *end && *end != ' '; ++end)
+            continue;
 
-    CPU_AND(&cpuset, &set->cs_mask);
-    cpuset_rel(set);
+        len = end - cur;
 
-    if (CPU_EMPTY(&cpuset))
-        return EINVAL;
+        for (p = 0; p < nitems(pmt_sweep_policyv); ++p) {
+            if (strlen(pmt_sweep_policyv[p]) == len &&
+                !strncmp(pmt_sweep_policyv[p], cur, len))
+                break;
+        }
 
-    cpusetobj_strprint(pmt_cpustr, &cpuset);
-    CPU_COPY(&cpuset, &pmt_cpuset);
+        if (p >= nitems(pmt_sweep_policyv))
+            return EINVAL;
+    }
 
-    sb = sbuf_new_auto();
-    if (!sb)
-        return ENOMEM;
+    strlcpy(pmt_sweep, sweep, sizeof(pmt_sweep));
 
-    sbuf_clear(sb);
+    return 0;
+}
 
-    /* Ensure roundup and align are of an integral page size.
-     */
-    round = roundup(pmt_roundup, PAGE_SIZE);
-    align = roundup(pmt_align, PAGE_SIZE);
+SYSCTL_PROC(_debug_pmt, OID_AUTO, sweep,
+            CTLTYPE_STRING | CTLFLAG_RW,
+            NULL, 0, pmt_sweep_sysctl, "A",
+            "vCPU orderings for a thread count sweep (smt core spread compact, empty to not sweep)");
 
-    samplesc = pmt_samples + 1;
-    if (samplesc < 2)
-        samplesc = 2;
-    else if (samplesc > 128)
-        samplesc = 128;
+static int
+pmt_work_sysctl(SYSCTL_HANDLER_ARGS)
+{
+    return sysctl_handle_string(oidp, pmt_work, sizeof(pmt_work), req);
+}
 
-    /* Determine how much memory we need to run the test.
-     */
-    memsz = sizeof(pmt_share_t) * samplesc * pmt_samples_step;
-    memsz = roundup(memsz, round);
+SYSCTL_PROC(_debug_pmt, OID_AUTO, work,
+            CTLTYPE_STRING | CTLFLAG_RW,
+            NULL, 0, pmt_work_sysctl, "A",
+            "test:cs/think lock work pairs, each in cycles or bytes (e.g., \"mutex:200+256b/1000\")");
 
-    mem = contigmalloc(memsz, M_PMT, M_NOWAIT, 0, ~(vm_paddr_t)0, align, 0);
-    if (!mem) {
-        printf("%s: unable to malloc %lu contiguous bytes\n", __func__, memsz);
+static int
+pmt_stream_size_sysctl(SYSCTL_HANDLER_ARGS)
+{
+    uint64_t size = pmt_stream_size;
+    int rc;
+
+    rc = sysctl_handle_64(oidp, &size, 0, req);
+    if (rc || !req->newptr)
+        return rc;
+
+    if (size < CACHE_LINE_SIZE)
+        return EINVAL;
+
+    pmt_stream_size = roundup(size, CACHE_LINE_SIZE);
+
+    return 0;
+}
+
+SYSCTL_PROC(_debug_pmt, OID_AUTO, stream_size,
+            CTLTYPE_U64 | CTLFLAG_RW,
+            NULL, 0, pmt_stream_size_sysctl, "QU",
+            "Size in bytes of each of each worker's three stream test arrays");
+
+static int
+pmt_tests_sysctl(SYSCTL_HANDLER_ARGS)
+{
+    int rc;
+
+    if (pmt_tests[0] == '\000' || 0 == strcmp(pmt_tests, "all"))
+        pmt_tests_reset();
+
+    rc = sysctl_handle_string(oidp, pmt_tests, sizeof(pmt_tests), req);
+
+    if (pmt_tests[0] == '\000' || 0 == strcmp(pmt_tests, "all"))
+        pmt_tests_reset();
+
+    return rc;
+}
+
+SYSCTL_PROC(_debug_pmt, OID_AUTO, tests,
+            CTLTYPE_STRING | CTLFLAG_RW,
+            NULL, 0, pmt_tests_sysctl, "A",
+            "List of tests to run");
+
+static int
+pmt_format_sysctl(SYSCTL_HANDLER_ARGS)
+{
+    char format[sizeof(pmt_format)];
+    int rc;
+
+    strlcpy(format, pmt_format, sizeof(format));
+
+    rc = sysctl_handle_string(oidp, format, sizeof(format), req);
+    if (rc || !req->newptr)
+        return rc;
+
+    if (strcmp(format, "text") && strcmp(format, "json") && strcmp(format, "csv"))
+        return EINVAL;
+
+    strlcpy(pmt_format, format, sizeof(pmt_format));
+
+    return 0;
+}
+
+SYSCTL_PROC(_debug_pmt, OID_AUTO, format,
+            CTLTYPE_STRING | CTLFLAG_RW,
+            NULL, 0, pmt_format_sysctl, "A",
+            "Format of debug.pmt.results from debug.pmt.run (text, json or csv)");
+
+/* Show the results of one sample on the console.
+ */
+static void
+pmt_print_sample(int n, const pmt_sample_t *sample)
+{
+    unsigned long cycles = 0;
+    unsigned long nsecs, iters;
+
+#ifdef PMT_TSC
+    cycles = sample->delta;
+#endif
+    nsecs = MAX(pmt_delta2nsecs(sample->delta), 1);
+    iters = MAX(sample->iters, 1);
+
+    printf("%4d %16s %12lu %12lu %12lu %8lu %12lu %9lu %10lu %10lu%s\n",
+           n, pmt_cpumask,
+           iters,                                   // CALLS
+           pmt_x1b_div_y(iters, nsecs),             // CALLS/s
+           nsecs,                                   // ns
+           nsecs / iters,                           // ns/CALL
+           cycles,                                  // CYCLES
+           cycles / iters,                          // CY/CALL
+           pmt_delta2nsecs(sample->start_skew),     // START-SKEW
+           pmt_delta2nsecs(sample->stop_skew),      // STOP-SKEW
+           sample->rejected ? " rejected" : "");
+}
+
+/* Find the number of iterations per worker for which one sample of the
+ * given test takes about pmt_duration milliseconds.  Each trial sample
+ * is run in sample slot 0, which is later overwritten.
+ */
+static int
+pmt_calibrate(pmt_test_t *ptest, pmt_pool_t *pool, void *mem, size_t memsz,
+              pmt_sample_t *samplesv, u_long *itersp)
+{
+    u_long target, nsecs, iters;
+    int rc;
+
+    target = pmt_duration * 1000000ul;
+    iters = 1000;
+
+    while (1) {
+        rc = pmt_run(ptest, pool, mem, memsz, 0, 1, iters, samplesv);
+        if (rc)
+            return rc;
+
+        nsecs = MAX(pmt_delta2nsecs(samplesv->delta), 1);
+
+        if (pmt_verbosity > 1)
+            printf("%s: calibrate %lu iters/worker took %lu ns\n",
+                   ptest->name, iters, nsecs);
+
+        if (nsecs >= target / 8 || iters >= PMT_ITERS_MAX)
+            break;
+
+        iters *= (nsecs < target / 100) ? 10 : 2;
+    }
+
+    iters = pmt_muldiv(iters, target, nsecs);
+    iters = MIN(MAX(iters, 1), PMT_ITERS_MAX);
+
+    if (pmt_verbosity > 0)
+        printf("%s: calibrated to %lu iters/worker\n", ptest->name, iters);
+
+    *itersp = iters;
+
+    return 0;
+}
+
+static inline int
+pmt_sample_accepted(const pmt_sample_t *sample)
+{
+    return !sample->rejected && !sample->outlier;
+}
+
+/* Return the cost of the given sample in picoseconds per call.
+ */
+static uint64_t
+pmt_sample_cost(const pmt_sample_t *sample)
+{
+    return pmt_muldiv(pmt_delta2nsecs(sample->delta), 1000, MAX(sample->iters, 1));
+}
+
+/* Subtract the framework overhead of ps picoseconds per call from the
+ * location statistics of the cost per call (clamping them at zero).
+ */
+static void
+pmt_stats_subtract(pmt_stats_t *stats, uint64_t ps)
+{
+    stats->min -= MIN(stats->min, ps);
+    stats->median -= MIN(stats->median, ps);
+    stats->mean -= MIN(stats->mean, ps);
+    stats->p90 -= MIN(stats->p90, ps);
+}
+
+/* Compute the statistics of the cost per call of all but the first
+ * sample (which we consider to be warm-up) and those rejected due to
+ * excessive start skew, marking outliers along the way.
+ */
+static void
+pmt_evaluate(pmt_sample_t *samplesv, int samplesc, pmt_stats_t *stats)
+{
+    uint64_t valv[PMT_STATS_MAX];
+    char outlierv[PMT_STATS_MAX];
+    int idxv[PMT_STATS_MAX];
+    int valc, i;
+
+    samplesc = MIN(samplesc, PMT_STATS_MAX + 1);
+
+    for (valc = 0, i = 1; i < samplesc; ++i) {
+        samplesv[i].outlier = 0;
+
+        if (samplesv[i].rejected)
+            continue;
+
+        valv[valc] = pmt_sample_cost(&samplesv[i]);
+        idxv[valc++] = i;
+    }
+
+    pmt_stats_compute(valv, valc, pmt_outlier_mad, outlierv, stats);
+
+    for (i = 0; i < valc; ++i)
+        samplesv[idxv[i]].outlier = outlierv[i];
+}
+
+/* Append the aggregate bandwidth of a stream test and that of its
+ * slowest, average and fastest worker (and, with debug.pmt.pervcpu,
+ * that of each worker) given the calls/s of each worker in ratev and
+ * the aggregate calls/s.
+ */
+static void
+pmt_report_stream(struct sbuf *sb, pmt_test_t *test, pmt_pool_t *pool,
+                  const u_long *ratev, u_long rate)
+{
+    u_long bw, min, max, sum;
+    int w;
+
+    min = ULONG_MAX;
+    max = sum = 0;
+
+    /* Bandwidths are in MB/s, i.e., GB/s scaled by 1000.
+     */
+    for (w = 0; w < pool->nworkers; ++w) {
+        bw = pmt_muldiv(ratev[w], test->bytes, 1000000);
+        min = MIN(min, bw);
+        max = MAX(max, bw);
+        sum += bw;
+    }
+
+    bw = pmt_muldiv(rate, test->bytes, 1000000);
+    sum /= pool->nworkers;
+
+    sbuf_printf(sb, "%7lu.%03lu %7lu.%03lu %7lu.%03lu %7lu.%03lu  %s\n",
+                bw / 1000, bw % 1000,
+                min / 1000, min % 1000,
+                sum / 1000, sum % 1000,
+                max / 1000, max % 1000,
+                test->name);
+
+    if (!pmt_pervcpu)
+        return;
+
+    for (w = 0; w < pool->nworkers; ++w) {
+        bw = pmt_muldiv(ratev[w], test->bytes, 1000000);
+
+        sbuf_printf(sb, "%7lu.%03lu %11s %11s %11s    %s vCPU %d\n",
+                    bw / 1000, bw % 1000, "", "", "",
+                    test->name, pool->workerv[w].vcpu);
+    }
+}
+
+/* Append the mixed test read and write counts and costs over the
+ * accepted samples.  The costs include that of reading the TSC.
+ */
+static void
+pmt_report_mix(struct sbuf *sb, pmt_test_t *test,
+               int samplesc, const pmt_sample_t *samplesv)
+{
+    uint64_t rcycles = 0, wcycles = 0;
+    u_long reads = 0, writes = 0;
+    u_long rcost, wcost, pct;
+    int i;
+
+    for (i = 1; i < samplesc; ++i) {
+        if (!pmt_sample_accepted(&samplesv[i]))
+            continue;
+
+        reads += samplesv[i].reads;
+        writes += samplesv[i].writes;
+        rcycles += samplesv[i].read_cycles;
+        wcycles += samplesv[i].write_cycles;
+    }
+
+    /* Costs are in picoseconds and the write fraction is scaled by 1000.
+     */
+    rcost = pmt_muldiv(rcycles, 1000000000000ul, tsc_freq) / MAX(reads, 1);
+    wcost = pmt_muldiv(wcycles, 1000000000000ul, tsc_freq) / MAX(writes, 1);
+    pct = pmt_muldiv(writes, 100000, MAX(reads + writes, 1));
+
+    sbuf_printf(sb, "%3lu.%03lu %12lu %12lu %7lu.%03lu %7lu.%03lu  %s\n",
+                pct / 1000, pct % 1000,
+                reads, writes,
+                rcost / 1000, rcost % 1000,
+                wcost / 1000, wcost % 1000,
+                test->name);
+}
+
+/* Append the number of lock handoffs measured over the accepted samples
+ * and their average latency, and the number of those not measured
+ * because the waiter never slept, if the test made any.
+ */
+static void
+pmt_report_handoff(struct sbuf *sb, pmt_test_t *test,
+                   int samplesc, const pmt_sample_t *samplesv)
+{
+    uint64_t cycles = 0;
+    u_long handoffs = 0;
+    u_long nosleep = 0;
+    u_long cost;
+    int i;
+
+    for (i = 1; i < samplesc; ++i) {
+        if (!pmt_sample_accepted(&samplesv[i]))
+            continue;
+
+        handoffs += samplesv[i].handoffs;
+        cycles += samplesv[i].handoff_cycles;
+        nosleep += samplesv[i].handoff_nosleep;
+    }
+
+    if (handoffs + nosleep < 1)
+        return;
+
+    /* The latency is in picoseconds.
+     */
+    cost = pmt_muldiv(cycles, 1000000000000ul, tsc_freq) / MAX(handoffs, 1);
+
+    sbuf_printf(sb, "%12lu %12lu %7lu.%03lu  %s\n",
+                handoffs, nosleep, cost / 1000, cost % 1000, test->name);
+}
+
+/* Parse debug.pmt.roles into rolev, returning the number of roles or -1
+ * if the spec is malformed or names an unknown test.  Tests that need
+ * the test region (chase, stream and stride) can't be given a role.
+ */
+static int
+pmt_roles_parse(pmt_role_t *rolev, int rolemax)
+{
+    char *cur, *colon, *end;
+    pmt_test_t *test;
+    size_t len;
+    int rolec = 0;
+
+    for (cur = pmt_roles; *cur; cur = end) {
+        while (*cur == ' ')
+            ++cur;
+        if (!*cur)
+            break;
+
+        for (end = cur; *end && *end != ' '; ++end)
+            continue;
+
+        colon = memchr(cur, ':', end - cur);
+        if (!colon || colon == cur || colon + 1 == end || rolec >= rolemax) {
+            printf("%s: invalid role %.*s\n", __func__, (int)(end - cur), cur);
+            return -1;
+        }
+
+        len = end - (colon + 1);
+
+        for (test = tests; test->name; ++test) {
+            if (strlen(test->name) == len && !strncmp(test->name, colon + 1, len))
+                break;
+        }
+
+        if (!test->name || test->roles || test->wss || test->bytes || test->stride) {
+            printf("%s: invalid role test %.*s\n", __func__, (int)len, colon + 1);
+            return -1;
+        }
+
+        len = MIN(colon - cur, sizeof(rolev[rolec].vcpus) - 1);
+        memcpy(rolev[rolec].vcpus, cur, len);
+        rolev[rolec].vcpus[len] = '\000';
+        rolev[rolec].test = test;
+        ++rolec;
+    }
+
+    return rolec;
+}
+
+/* Return true if vcpu is in the given list of vCPUs and vCPU ranges.
+ */
+static int
+pmt_roles_match(const char *vcpus, int vcpu)
+{
+    const char *cur = vcpus;
+    u_long first, last;
+    char *end;
+
+    while (*cur) {
+        first = last = strtoul(cur, &end, 0);
+        if (end == cur)
+            break;
+
+        if (*end == '-') {
+            cur = end + 1;
+            last = strtoul(cur, &end, 0);
+            if (end == cur)
+                break;
+        }
+
+        if (vcpu >= first && vcpu <= last)
+            return 1;
+
+        if (*end != ',')
+            break;
+
+        cur = end + 1;
+    }
+
+    return 0;
+}
+
+/* Append the throughput of each role of the roles test, given the
+ * calls/s of each worker in ratev.
+ */
+static void
+pmt_report_roles(struct sbuf *sb, pmt_pool_t *pool, const pmt_role_t *rolev,
+                 int rolec, int samplesc, const pmt_sample_t *samplesv,
+                 const u_long *ratev)
+{
+    u_long rate, delta, iters, cost;
+    int r, w, i, nworkers;
+
+    for (r = 0; r < rolec; ++r) {
+        rate = delta = iters = 0;
+        nworkers = 0;
+
+        for (w = 0; w < pool->nworkers; ++w) {
+            if (pool->workerv[w].role != r)
+                continue;
+
+            for (i = 1; i < samplesc; ++i) {
+                if (!pmt_sample_accepted(&samplesv[i]))
+                    continue;
+
+                delta += samplesv[i].workerv[w].delta;
+                iters += samplesv[i].workerv[w].iters;
+            }
+
+            rate += ratev[w];
+            ++nworkers;
+        }
+
+        /* The cost per call is that of each worker, in picoseconds.
+         */
+        cost = pmt_muldiv(pmt_delta2nsecs(delta), 1000, MAX(iters, 1));
+
+        sbuf_printf(sb, "%-16s %3d %12lu %7lu.%03lu  %s\n",
+                    rolev[r].vcpus,
+                    nworkers,
+                    rate,
+                    cost / 1000, cost % 1000,
+                    rolev[r].test->name);
+    }
+}
+
+/* Parse one side (cs or think) of a debug.pmt.work pair:  A number of
+ * cycles and/or a number of bytes suffixed by 'b', joined by '+' (e.g.,
+ * "200", "256b" or "200+256b").
+ */
+static int
+pmt_work_value(char **curp, const char *end, u_int *cyclesp, u_int *bytesp)
+{
+    char *cur = *curp;
+    u_long val;
+
+    while (1) {
+        val = strtoul(cur, curp, 0);
+        if (*curp == cur || *curp > end)
+            return -1;
+
+        cur = *curp;
+
+        if (cur < end && *cur == 'b') {
+            if (val > PMT_WORK_MAX)
+                return -1;
+            *bytesp = val;
+            ++cur;
+        } else {
+            *cyclesp = MIN(val, UINT_MAX);
+        }
+
+        if (cur >= end || *cur != '+')
+            break;
+
+        ++cur;
+    }
+
+    *curp = cur;
+
+    return 0;
+}
+
+/* Parse debug.pmt.work into the work parameters of each test it names,
+ * clearing those of all other tests.  Returns the number of tests given
+ * work, or -1 if debug.pmt.work is invalid.
+ */
+static int
+pmt_work_parse(void)
+{
+    char *cur, *colon, *end, *pos;
+    pmt_test_t *test;
+    size_t len;
+    int workc = 0;
+
+    for (test = tests; test->name; ++test) {
+        test->cs_cycles = test->cs_bytes = 0;
+        test->think_cycles = test->think_bytes = 0;
+    }
+
+    for (cur = pmt_work; *cur; cur = end) {
+        while (*cur == ' ')
+            ++cur;
+        if (!*cur)
+            break;
+
+        for (end = cur; *end && *end != ' '; ++end)
+            continue;
+
+        colon = memchr(cur, ':', end - cur);
+        if (!colon || colon == cur) {
+            printf("%s: invalid work %.*s\n", __func__, (int)(end - cur), cur);
+            return -1;
+        }
+
+        len = colon - cur;
+
+        for (test = tests; test->name; ++test) {
+            if (strlen(test->name) == len && !strncmp(test->name, cur, len))
+                break;
+        }
+
+        if (!test->name || !test->work) {
+            printf("%s: invalid work test %.*s\n", __func__, (int)len, cur);
+            return -1;
+        }
+
+        pos = colon + 1;
+
+        if (pmt_work_value(&pos, end, &test->cs_cycles, &test->cs_bytes) ||
+            pos >= end || *pos++ != '/' ||
+            pmt_work_value(&pos, end, &test->think_cycles, &test->think_bytes) ||
+            pos != end) {
+            printf("%s: invalid work %.*s\n", __func__, (int)(end - cur), cur);
+            return -1;
+        }
+
+        ++workc;
+    }
+
+    return workc;
+}
+
+/* Measure the cycles per 1000 pause loops (the least of several tries)
+ * unless given by debug.pmt.pause_cycles.
+ */
+static u_long
+pmt_work_calibrate(void)
+{
+    uint64_t start, cycles, best;
+    int i, j;
+
+    if (pmt_pause_cycles > 0)
+        return pmt_pause_cycles;
+
+    best = UINT64_MAX;
+
+    for (i = 0; i < 5; ++i) {
+        start = rdtsc();
+        for (j = 0; j < 10000; ++j)
+            cpu_spinwait();
+        cycles = rdtsc() - start;
+
+        best = MIN(best, cycles);
+    }
+
+    return MAX(best / 10, 1);
+}
+
+/* Return the number of pause loops that take the given number of cycles.
+ */
+static u_int
+pmt_work_spins(u_int cycles)
+{
+    return cycles ? MAX(pmt_muldiv(cycles, 1000, pmt_pause_x1000), 1) : 0;
+}
+
+/* Append the work parameters of the given test, if any, to sb.
+ */
+static void
+pmt_report_work(struct sbuf *sb, const pmt_test_t *test)
+{
+    if (!test->cs_cycles && !test->cs_bytes &&
+        !test->think_cycles && !test->think_bytes)
+        return;
+
+    sbuf_printf(sb, "%9u %9u %8u %9u %9u %8u  %s\n",
+                test->cs_cycles, pmt_work_spins(test->cs_cycles),
+                test->cs_bytes,
+                test->think_cycles, pmt_work_spins(test->think_cycles),
+                test->think_bytes,
+                test->name);
+}
+
+/* Parse debug.pmt.offsets into offv, returning the number of offsets.
+ */
+static int
+pmt_offsets_parse(u_long *offv, int offmax)
+{
+    char *cur, *end;
+    int offc = 0;
+
+    for (cur = pmt_offsets; *cur && offc < offmax; cur = end) {
+        while (*cur == ' ' || *cur == ',')
+            ++cur;
+        if (!*cur)
+            break;
+
+        offv[offc] = strtoul(cur, &end, 0);
+        if (end == cur)
+            break;
+
+        ++offc;
+    }
+
+    return offc;
+}
+
+/* Return "page" or "line" if any of the locks in shared data placed at
+ * the given offset would straddle a page or cache line, else "-".
+ */
+static const char *
+pmt_offset_split(u_long off)
+{
+    static const struct {
+        size_t  offset;
+        size_t  size;
+    } lockv[] = {
+        { offsetof(pmt_share_t, mtx), sizeof(struct mtx) },
+        { offsetof(pmt_share_t, spin), sizeof(struct mtx) },
+        { offsetof(pmt_share_t, rw), sizeof(struct rwlock) },
+        { offsetof(pmt_share_t, sx), sizeof(struct sx) },
+        { offsetof(pmt_share_t, rm), sizeof(struct rmlock) },
+    };
+    const char *split = "-";
+    u_long first, last;
+    int i;
+
+    for (i = 0; i < nitems(lockv); ++i) {
+        first = off + lockv[i].offset;
+        last = first + lockv[i].size - 1;
+
+        if (first / PAGE_SIZE != last / PAGE_SIZE)
+            return "page";
+
+        if (first / CACHE_LINE_SIZE != last / CACHE_LINE_SIZE)
+            split = "line";
+    }
+
+    return split;
+}
+
+/* Run the given test with the shared data of all samples placed at each
+ * of the given offsets into the test region in turn, and append the
+ * statistics of the cost per call at each offset (without any baseline
+ * subtracted) rather than averaging them together.
+ */
+static int
+pmt_offsets_sweep(struct sbuf *sb, pmt_test_t *test, pmt_pool_t *pool,
+                  void *mem, size_t memsz, u_long iters,
+                  int samplesc, pmt_sample_t *samplesv,
+                  const u_long *offv, int offc)
+{
+    pmt_stats_t stats;
+    u_long off;
+    int rc = 0;
+    int i;
+
+    for (i = 0; i < offc; ++i) {
+        off = offv[i];
+
+        pool->shroff = off;
+        rc = pmt_run(test, pool, mem, memsz, 0, samplesc, iters, samplesv);
+        pool->shroff = -1;
+        if (rc)
+            break;
+
+        pmt_evaluate(samplesv, samplesc, &stats);
+
+        sbuf_printf(sb, "%8lu %8lu %5s %3d %7lu.%03lu %7lu.%03lu %7lu.%03lu  %s\n",
+                    off,
+                    (u_long)((off + offsetof(pmt_share_t, mtx)) % PAGE_SIZE),
+                    pmt_offset_split(off),
+                    stats.n,
+                    stats.median / 1000, stats.median % 1000,
+                    stats.mean / 1000, stats.mean % 1000,
+                    stats.ci / 1000, stats.ci % 1000,
+                    test->name);
+    }
+
+    return rc;
+}
+
+/* Sum the hardware counter counts of all the workers over the accepted
+ * samples of a test.
+ */
+static void
+pmt_pmc_sum(pmt_pool_t *pool, int samplesc, const pmt_sample_t *samplesv,
+            pmt_pmcres_t *res)
+{
+    int i, w, k;
+
+    memset(res, 0, sizeof(*res));
+
+    for (i = 1; i < samplesc; ++i) {
+        if (!pmt_sample_accepted(&samplesv[i]))
+            continue;
+
+        for (w = 0; w < pool->nworkers; ++w) {
+            const pmt_wsample_t *wsample = &samplesv[i].workerv[w];
+
+            res->iters += wsample->iters;
+
+            for (k = 0; k < PMT_PMC_MAX; ++k)
+                res->countv[k] += wsample->pmcv[k];
+        }
+    }
+}
+
+/* Append the hardware counter results of each test: instructions per
+ * cycle and then the number of each event per call.  Counters that
+ * aren't available on all vCPUs (per mask) are shown as "-".
+ */
+static void
+pmt_report_pmc(struct sbuf *sb, const pmt_pmcres_t *resv, u_int mask, int rc)
+{
+    pmt_test_t *test;
+    int k;
+
+    if (!mask) {
+        sbuf_printf(sb, "\nhardware counters unavailable (error %d)\n", rc);
+        return;
+    }
+
+    sbuf_printf(sb, "\n%11s %11s %11s %11s %11s %11s  %s\n",
+                "IPC", "INSTR", "L1D-MISS", "LLC-MISS", "BR-MISS", "HITM",
+                "NAME (per CALL)");
+
+    for (test = tests; test->name; ++test) {
+        const pmt_pmcres_t *res = &resv[test - tests];
+        u_long val;
+
+        if (res->iters < 1)
+            continue;
+
+        if ((mask & (1u << PMT_PMC_CYCLES)) && (mask & (1u << PMT_PMC_INSTR))) {
+            val = pmt_muldiv(res->countv[PMT_PMC_INSTR], 1000,
+                             res->countv[PMT_PMC_CYCLES]);
+            sbuf_printf(sb, "%7lu.%03lu", val / 1000, val % 1000);
+        } else {
+            sbuf_printf(sb, "%11s", "-");
+        }
+
+        for (k = PMT_PMC_INSTR; k < PMT_PMC_MAX; ++k) {
+            if (mask & (1u << k)) {
+                val = pmt_muldiv(res->countv[k], 1000, res->iters);
+                sbuf_printf(sb, " %7lu.%03lu", val / 1000, val % 1000);
+            } else {
+                sbuf_printf(sb, " %11s", "-");
+            }
+        }
+
+        sbuf_printf(sb, "  %s\n", test->name);
+    }
+}
+
+/* Append the NUMA placement of the shared data (the set of domains on
+ * which it landed over all samples) and of each worker's private data.
+ */
+static void
+pmt_report_numa(struct sbuf *sb, pmt_pool_t *pool, u_long shr_domains)
+{
+    static const char *policyv[] = { "local", "remote", "interleave" };
+    char domains[MAXMEMDOM * 4];
+    u_int nlocal = 0;
+    size_t len = 0;
+    int w, d;
+
+    for (w = 0; w < pool->nworkers; ++w) {
+        if (pool->workerv[w].priv_domain == pool->workerv[w].domain)
+            ++nlocal;
+    }
+
+    sbuf_printf(sb, "\n%7s %-10s %-12s %s\n",
+                "DOMAINS", "SHARED", "SHR-DOMAINS", "PRIV-LOCAL");
+
+    domains[0] = '\000';
+
+    for (d = 0; d < MAXMEMDOM && len < sizeof(domains); ++d) {
+        if (shr_domains & (1ul << d)) {
+            shr_domains &= ~(1ul << d);
+            len += snprintf(domains + len, sizeof(domains) - len,
+                            "%d%s", d, shr_domains ? "," : "");
+        }
+    }
+
+    sbuf_printf(sb, "%7d %-10s %-12s %u/%u\n",
+                vm_ndomains,
+                pmt_shr_domain < nitems(policyv) ? policyv[pmt_shr_domain] : "local",
+                domains,
+                nlocal, pool->nworkers);
+
+    if (!pmt_pervcpu)
+        return;
+
+    sbuf_printf(sb, "\n%5s %6s %11s\n", "vCPU", "DOMAIN", "PRIV-DOMAIN");
+
+    for (w = 0; w < pool->nworkers; ++w) {
+        sbuf_printf(sb, "%5d %6d %11d\n",
+                    pool->workerv[w].vcpu,
+                    pool->workerv[w].domain,
+                    pool->workerv[w].priv_domain);
+    }
+}
+
+/* Append one line per vCPU to the results, showing each worker's average
+ * calls and time over the accepted samples of the given test (without
+ * any baseline subtracted).
+ */
+static void
+pmt_report_pervcpu(struct sbuf *sb, pmt_test_t *test, pmt_pool_t *pool,
+                   int samplesc, pmt_sample_t *samplesv)
+{
+    int naccepted, w, i;
+
+    for (w = 0; w < pool->nworkers; ++w) {
+        unsigned long cycles = 0, nsecs = 0, iters = 0;
+
+        naccepted = 0;
+
+        for (i = 1; i < samplesc; ++i) {
+            if (!pmt_sample_accepted(&samplesv[i]))
+                continue;
+
+            nsecs += samplesv[i].workerv[w].delta;
+            iters += samplesv[i].workerv[w].iters;
+            ++naccepted;
+        }
+
+        if (naccepted < 1)
+            return;
+
+        nsecs /= naccepted;
+        iters /= naccepted;
+
+#ifdef PMT_TSC
+        cycles = nsecs;
+        nsecs = pmt_cycles2nsecs(cycles);
+#endif
+
+        if (nsecs < 1 || iters < 1)
+            continue;
+
+        sbuf_printf(sb, "%16d %3u %12lu %12lu %12lu %8lu %12lu %8lu %10s %3s %7s %7s %7s    %s\n",
+                    pool->workerv[w].vcpu,                  // vCPU
+                    1,                                      // TDS
+                    iters,                                  // CALLS
+                    pmt_x1b_div_y(iters, nsecs),            // CALLS/s
+                    nsecs,                                  // ns
+                    nsecs / iters,                          // ns/CALL
+                    cycles,                                 // CYCLES
+                    cycles / iters,                         // CY/CALL
+                    "", "", "", "", "",
+                    test->name);
+    }
+}
+
+/* Parse the given cpuset string and restrict it to the vCPUs available
+ * to us.
+ */
+static int
+pmt_cpuset_scan(char *cpustr, cpuset_t *cpuset)
+{
+    struct cpuset *set;
+    struct thread *td;
+    struct proc *proc;
+    int rc;
+
+    rc = cpusetobj_strscan(cpuset, cpustr);
+    if (rc)
+        return EINVAL;
+
+    rc = cpuset_which(CPU_WHICH_CPUSET, -1, &proc, &td, &set);
+    if (rc)
+        return rc;
+
+    CPU_AND(cpuset, &set->cs_mask);
+    cpuset_rel(set);
+
+    if (CPU_EMPTY(cpuset))
+        return EINVAL;
+
+    return 0;
+}
+
+/* Structured (JSON or CSV) results of a run, built alongside the text
+ * results when debug.pmt.format isn't "text".  The JSON results are an
+ * object with the run's metadata and an array of the runs on each cpuset
+ * (one per thread count of a sweep), each with an array of its tests,
+ * each with an array of all its samples, each with an array of its
+ * per-worker results.  The CSV results have a row per worker per sample,
+ * preceded by the metadata as "# key: value" comment lines.
+ */
+static struct sbuf *pmt_rec;        // Structured results (NULL if text)
+static int pmt_rec_json;            // JSON rather than CSV
+static int pmt_rec_runs;            // Number of runs begun
+static int pmt_rec_tests;           // Number of tests in the current run
+static int pmt_rec_metas;           // Number of metadata keys
+
+static void
+pmt_json_str(struct sbuf *sb, const char *str)
+{
+    sbuf_printf(sb, "\"");
+
+    for (; *str; ++str) {
+        if (*str == '"' || *str == '\\')
+            sbuf_printf(sb, "\\%c", *str);
+        else if ((u_char)*str < 0x20)
+            sbuf_printf(sb, "\\u%04x", (u_char)*str);
+        else
+            sbuf_printf(sb, "%c", *str);
+    }
+
+    sbuf_printf(sb, "\"");
+}
+
+static void
+pmt_csv_str(struct sbuf *sb, const char *str)
+{
+    sbuf_printf(sb, "\"");
+
+    for (; *str; ++str) {
+        if (*str == '"')
+            sbuf_printf(sb, "\"\"");
+        else
+            sbuf_printf(sb, "%c", *str);
+    }
+
+    sbuf_printf(sb, "\"");
+}
+
+/* Append one metadata key with either the given string or, if str is
+ * NULL, the given number.
+ */
+static void
+pmt_rec_meta(const char *key, const char *str, u_long val)
+{
+    if (pmt_rec_json) {
+        sbuf_printf(pmt_rec, "%s\n    \"%s\": ", pmt_rec_metas++ ? "," : "", key);
+        if (str)
+            pmt_json_str(pmt_rec, str);
+        else
+            sbuf_printf(pmt_rec, "%lu", val);
+    } else {
+        if (str)
+            sbuf_printf(pmt_rec, "# %s: %s\n", key, str);
+        else
+            sbuf_printf(pmt_rec, "# %s: %lu\n", key, val);
+    }
+}
+
+/* Begin the structured results of a run on the given cpuset (if
+ * debug.pmt.format asks for them), starting with the metadata.
+ */
+static int
+pmt_rec_begin(cpuset_t *cpuset)
+{
+    char cpustr[CPUSETBUFSIZ];
+
+    if (!strcmp(pmt_format, "text"))
+        return 0;
+
+    pmt_rec = sbuf_new_auto();
+    if (!pmt_rec)
+        return ENOMEM;
+
+    sbuf_clear(pmt_rec);
+    pmt_rec_json = !strcmp(pmt_format, "json");
+    pmt_rec_runs = pmt_rec_metas = 0;
+
+    if (pmt_rec_json)
+        sbuf_printf(pmt_rec, "{\n  \"meta\": {");
+
+    cpusetobj_strprint(cpustr, cpuset);
+
+#ifdef _KERNEL
+    pmt_rec_meta("kernel", NULL, 1);
+#else
+    pmt_rec_meta("kernel", NULL, 0);
+#endif
+    pmt_rec_meta("cpu_model", cpu_model, 0);
+    pmt_rec_meta("tsc_freq", NULL, tsc_freq);
+    pmt_rec_meta("cpuset", cpustr, 0);
+    pmt_rec_meta("tests", pmt_tests, 0);
+    pmt_rec_meta("iters", NULL, pmt_iters);
+    pmt_rec_meta("duration", NULL, pmt_duration);
+    pmt_rec_meta("timed", NULL, pmt_timed);
+    pmt_rec_meta("samples", NULL, pmt_samples);
+    pmt_rec_meta("samples_max", NULL, pmt_samples_max);
+    pmt_rec_meta("samples_step", NULL, pmt_samples_step);
+    pmt_rec_meta("outlier_mad", NULL, pmt_outlier_mad);
+    pmt_rec_meta("ci_target", NULL, pmt_ci_target);
+    pmt_rec_meta("skew_max", NULL, pmt_skew_max);
+    pmt_rec_meta("pri", NULL, pmt_pri);
+    pmt_rec_meta("roundup", NULL, pmt_roundup);
+    pmt_rec_meta("align", NULL, pmt_align);
+    pmt_rec_meta("shr_domain", NULL, pmt_shr_domain);
+    pmt_rec_meta("chase_max", NULL, pmt_chase_max);
+    pmt_rec_meta("stream_size", NULL, pmt_stream_size);
+    pmt_rec_meta("spin_budget", NULL, pmt_spin_budget);
+    pmt_rec_meta("pause_cycles", NULL, pmt_pause_cycles);
+    pmt_rec_meta("pmc", NULL, pmt_pmc);
+    pmt_rec_meta("offsets", pmt_offsets, 0);
+    pmt_rec_meta("roles", pmt_roles, 0);
+    pmt_rec_meta("work", pmt_work, 0);
+    pmt_rec_meta("sweep", pmt_sweep, 0);
+#ifdef PMT_TSC
+    pmt_rec_meta("PMT_TSC", NULL, 1);
+    pmt_rec_meta("delta_units", "cycles", 0);
+#else
+    pmt_rec_meta("PMT_TSC", NULL, 0);
+    pmt_rec_meta("delta_units", "nsecs", 0);
+#endif
+    pmt_rec_meta("PMT_LOOP_UNROLL", NULL, PMT_LOOP_UNROLL);
+
+    if (pmt_rec_json)
+        sbuf_printf(pmt_rec, "\n  },\n  \"runs\": [");
+    else
+        sbuf_printf(pmt_rec, "run,policy,vcpumask,tds,test,calls,calls_per_sec,ns,cycles,"
+                    "sample,accepted,rejected,outlier,sample_delta,sample_iters,"
+                    "start_skew,stop_skew,domain,worker,vcpu,delta,nsecs,iters\n");
+
+    return 0;
+}
+
+/* Begin the results of the tests run by the given pool.
+ */
+static void
+pmt_rec_run(pmt_pool_t *pool)
+{
+    int w;
+
+    ++pmt_rec_runs;
+    pmt_rec_tests = 0;
+
+    if (!pmt_rec || !pmt_rec_json)
+        return;
+
+    sbuf_printf(pmt_rec, "%s\n    {\"cpuset\": ", pmt_rec_runs > 1 ? "," : "");
+    pmt_json_str(pmt_rec, pmt_cpustr);
+    sbuf_printf(pmt_rec, ", \"vcpumask\": \"%s\", \"tds\": %d, \"policy\": ",
+                pmt_cpumask, pool->nworkers);
+    pmt_json_str(pmt_rec, pmt_sweep_policy ? pmt_sweep_policy : "");
+    sbuf_printf(pmt_rec, ", \"pause_cycles_x1000\": %lu, \"vcpus\": [", pmt_pause_x1000);
+
+    for (w = 0; w < pool->nworkers; ++w)
+        sbuf_printf(pmt_rec, "%s%d", w ? ", " : "", pool->workerv[w].vcpu);
+
+    sbuf_printf(pmt_rec, "],\n     \"tests\": [");
+}
+
+static void
+pmt_rec_run_end(void)
+{
+    if (pmt_rec && pmt_rec_json)
+        sbuf_printf(pmt_rec, "\n    ]}");
+}
+
+/* Append the results of one test:  The reported averages and the
+ * statistics of the cost per call (after the framework overhead is
+ * subtracted), and every sample (including the discarded first sample).
+ * Zero iters means the test has no averages (no sample was accepted,
+ * or the cost did not exceed the overhead), which are then left null
+ * (or empty in the CSV).
+ */
+static void
+pmt_rec_test(pmt_test_t *test, pmt_pool_t *pool, int nsamples,
+             const pmt_sample_t *samplesv, const pmt_stats_t *stats,
+             u_long iters, u_long nsecs, u_long cycles)
+{
+    u_long rate = pmt_x1b_div_y(iters, nsecs);
+    char avg[96];
+    int i, w;
+
+    if (!pmt_rec)
+        return;
+
+    if (!pmt_rec_json) {
+        if (iters > 0)
+            snprintf(avg, sizeof(avg), "%lu,%lu,%lu,%lu", iters, rate, nsecs, cycles);
+        else
+            strlcpy(avg, ",,,", sizeof(avg));
+
+        for (i = 0; i < nsamples; ++i) {
+            const pmt_sample_t *sample = &samplesv[i];
+
+            for (w = 0; w < pool->nworkers; ++w) {
+                const pmt_wsample_t *wsample = &sample->workerv[w];
+
+                sbuf_printf(pmt_rec, "%d,", pmt_rec_runs);
+                pmt_csv_str(pmt_rec, pmt_sweep_policy ? pmt_sweep_policy : "");
+                sbuf_printf(pmt_rec, ",%s,%d,", pmt_cpumask, pool->nworkers);
+                pmt_csv_str(pmt_rec, test->name);
+                sbuf_printf(pmt_rec, ",%s,%d,%d,%d,%d,%lu,%lu,%lu,%lu,%d,"
+                            "%d,%d,%lu,%lu,%lu\n",
+                            avg, i, i > 0 && pmt_sample_accepted(sample),
+                            sample->rejected, sample->outlier,
+                            sample->delta, sample->iters,
+                            sample->start_skew, sample->stop_skew, sample->domain,
+                            w, pool->workerv[w].vcpu,
+                            wsample->delta, pmt_delta2nsecs(wsample->delta),
+                            wsample->iters);
+            }
+        }
+
+        return;
+    }
+
+    sbuf_printf(pmt_rec, "%s\n      {\"name\": ", pmt_rec_tests++ ? "," : "");
+    pmt_json_str(pmt_rec, test->name);
+    if (iters > 0)
+        sbuf_printf(pmt_rec, ", \"calls\": %lu, \"calls_per_sec\": %lu, \"ns\": %lu, "
+                    "\"cycles\": %lu,\n", iters, rate, nsecs, cycles);
+    else
+        sbuf_printf(pmt_rec, ", \"calls\": null, \"calls_per_sec\": null, \"ns\": null, "
+                    "\"cycles\": null,\n");
+
+    sbuf_printf(pmt_rec, "       \"stats\": {\"n\": %d, \"outliers\": %d, \"min_ps\": %lu, "
+                "\"median_ps\": %lu, \"mean_ps\": %lu, \"stddev_ps\": %lu, "
+                "\"p90_ps\": %lu, \"ci95_ps\": %lu},\n",
+                stats->n, stats->noutliers, stats->min, stats->median,
+                stats->mean, stats->stddev, stats->p90, stats->ci);
+
+    if (test->work) {
+        sbuf_printf(pmt_rec, "       \"work\": {\"cs_cycles\": %u, \"cs_spins\": %u, "
+                    "\"cs_bytes\": %u, \"think_cycles\": %u, \"think_spins\": %u, "
+                    "\"think_bytes\": %u},\n",
+                    test->cs_cycles, pmt_work_spins(test->cs_cycles), test->cs_bytes,
+                    test->think_cycles, pmt_work_spins(test->think_cycles),
+                    test->think_bytes);
+    }
+
+    sbuf_printf(pmt_rec, "       \"samples\": [");
+
+    for (i = 0; i < nsamples; ++i) {
+        const pmt_sample_t *sample = &samplesv[i];
+
+        sbuf_printf(pmt_rec, "%s\n        {\"accepted\": %s, \"rejected\": %d, "
+                    "\"outlier\": %d, \"delta\": %lu, \"nsecs\": %lu, \"iters\": %lu, "
+                    "\"start_skew\": %lu, \"stop_skew\": %lu, \"domain\": %d, "
+                    "\"workers\": [",
+                    i ? "," : "",
+                    (i > 0 && pmt_sample_accepted(sample)) ? "true" : "false",
+                    sample->rejected, sample->outlier,
+                    sample->delta, pmt_delta2nsecs(sample->delta), sample->iters,
+                    sample->start_skew, sample->stop_skew, sample->domain);
+
+        for (w = 0; w < pool->nworkers; ++w) {
+            const pmt_wsample_t *wsample = &sample->workerv[w];
+
+            sbuf_printf(pmt_rec, "%s{\"vcpu\": %d, \"delta\": %lu, \"nsecs\": %lu, "
+                        "\"iters\": %lu}",
+                        w ? ", " : "", pool->workerv[w].vcpu,
+                        wsample->delta, pmt_delta2nsecs(wsample->delta),
+                        wsample->iters);
+        }
+
+        sbuf_printf(pmt_rec, "]}");
+    }
+
+    sbuf_printf(pmt_rec, "]}");
+}
+
+/* Close the JSON array of runs.
+ */
+static void
+pmt_rec_runs_end(void)
+{
+    if (pmt_rec_json && pmt_rec_runs >= 0) {
+        sbuf_printf(pmt_rec, "\n  ]");
+        pmt_rec_runs = -1;
+    }
+}
+
+/* Finish the structured results, which become debug.pmt.results.
+ */
+static void
+pmt_rec_end(void)
+{
+    pmt_rec_runs_end();
+
+    if (pmt_rec_json)
+        sbuf_printf(pmt_rec, "\n}\n");
+
+    sbuf_finish(pmt_rec);
+}
+
+/* Replace debug.pmt.results with the contents of sb, which may be of
+ * any length.
+ */
+static void
+pmt_results_set(struct sbuf *sb)
+{
+    char *results;
+
+    results = malloc(sbuf_len(sb) + 1, M_PMT, M_WAITOK);
+    if (results)
+        memcpy(results, sbuf_data(sb), sbuf_len(sb) + 1);
+
+    free(pmt_results, M_PMT);
+    pmt_results = results;
+}
+
+
+/* A baseline entry:  The cost per call (in ps) of each accepted sample
+ * of one test at one thread count (and sweep ordering).
+ */
+typedef struct {
+    char        test[48];
+    char        policy[8];      // Sweep ordering (empty if not swept)
+    int         tds;
+    int         n;
+    uint64_t    costv[PMT_STATS_MAX];
+} pmt_blent_t;
+
+/* A named baseline, saved from the results of a run or loaded from the
+ * text of debug.pmt.baseline.
+ */
+typedef struct {
+    char         name[32];
+    int          entc;
+    int          entmax;
+    pmt_blent_t *entv;
+} pmt_bl_t;
+
+static pmt_bl_t pmt_bl_last;                    // Results of the latest run
+static pmt_bl_t pmt_blv[PMT_BASELINES_MAX];     // Named baselines (unused if no name)
+
+static void
+pmt_bl_clear(pmt_bl_t *bl)
+{
+    free(bl->entv, M_PMT);
+    bl->entv = NULL;
+    bl->entc = bl->entmax = 0;
+}
+
+/* Append a zeroed entry to the given baseline.
+ */
+static pmt_blent_t *
+pmt_bl_append(pmt_bl_t *bl)
+{
+    pmt_blent_t *entv;
+
+    if (bl->entc >= bl->entmax) {
+        int entmax = MAX(bl->entmax * 2, 16);
+
+        entv = malloc(sizeof(*entv) * entmax, M_PMT, M_WAITOK);
+        if (!entv)
+            return NULL;
+
+        if (bl->entc > 0)
+            memcpy(entv, bl->entv, sizeof(*entv) * bl->entc);
+
+        free(bl->entv, M_PMT);
+        bl->entv = entv;
+        bl->entmax = entmax;
+    }
+
+    entv = &bl->entv[bl->entc++];
+    memset(entv, 0, sizeof(*entv));
+
+    return entv;
+}
+
+static pmt_blent_t *
+pmt_bl_find(pmt_bl_t *bl, const pmt_blent_t *key)
+{
+    int i;
+
+    for (i = 0; i < bl->entc; ++i) {
+        pmt_blent_t *ent = &bl->entv[i];
+
+        if (ent->tds == key->tds && !strcmp(ent->test, key->test) &&
+            !strcmp(ent->policy, key->policy))
+            return ent;
+    }
+
+    return NULL;
+}
+
+/* Return the named baseline, or (if create is set) an unused one.
+ */
+static pmt_bl_t *
+pmt_bl_lookup(const char *name, int create)
+{
+    pmt_bl_t *unused = NULL;
+    int i;
+
+    for (i = 0; i < PMT_BASELINES_MAX; ++i) {
+        if (!strcmp(pmt_blv[i].name, name))
+            return &pmt_blv[i];
+
+        if (!unused && !pmt_blv[i].name[0])
+            unused = &pmt_blv[i];
+    }
+
+    if (!create || !unused)
+        return NULL;
+
+    strlcpy(unused->name, name, sizeof(unused->name));
+
+    return unused;
+}
+
+/* Record the costs of the accepted samples of one test in the results
+ * of the latest run.
+ */
+static void
+pmt_bl_record(pmt_test_t *test, pmt_pool_t *pool, int nsamples,
+              const pmt_sample_t *samplesv)
+{
+    pmt_blent_t *ent;
+    int i;
+
+    ent = pmt_bl_append(&pmt_bl_last);
+    if (!ent)
+        return;
+
+    strlcpy(ent->test, test->name, sizeof(ent->test));
+    strlcpy(ent->policy, pmt_sweep_policy ? pmt_sweep_policy : "", sizeof(ent->policy));
+    ent->tds = pool->nworkers;
+
+    for (i = 1; i < nsamples && ent->n < PMT_STATS_MAX; ++i) {
+        if (pmt_sample_accepted(&samplesv[i]))
+            ent->costv[ent->n++] = pmt_sample_cost(&samplesv[i]);
+    }
+}
+
+/* Writing a name saves the results of the latest run as the baseline of
+ * that name (replacing any baseline of that name).  Reading shows the
+ * names of all baselines.
+ */
+static int
+pmt_save_sysctl(SYSCTL_HANDLER_ARGS)
+{
+    char name[sizeof(pmt_blv[0].name)];
+    struct sbuf *sb;
+    pmt_bl_t *bl;
+    int rc, i;
+
+    sb = sbuf_new_auto();
+    if (!sb)
+        return ENOMEM;
+
+    for (i = 0; i < PMT_BASELINES_MAX; ++i) {
+        if (pmt_blv[i].name[0])
+            sbuf_printf(sb, "%s%s", sbuf_len(sb) > 0 ? " " : "", pmt_blv[i].name);
+    }
+
+    sbuf_finish(sb);
+    rc = SYSCTL_OUT(req, sbuf_data(sb), sbuf_len(sb) + 1);
+    sbuf_delete(sb);
+
+    if (rc || !req->newptr)
+        return rc;
+
+    if (req->newlen >= sizeof(name))
+        return ENAMETOOLONG;
+
+    rc = SYSCTL_IN(req, name, req->newlen);
+    if (rc)
+        return rc;
+
+    name[req->newlen] = '\000';
+
+    if (!name[0] || strchr(name, ' '))
+        return EINVAL;
+
+    if (pmt_bl_last.entc < 1)
+        return ENOENT;
+
+    bl = pmt_bl_lookup(name, 1);
+    if (!bl)
+        return ENOSPC;
+
+    pmt_bl_clear(bl);
+
+    for (i = 0; i < pmt_bl_last.entc; ++i) {
+        pmt_blent_t *ent = pmt_bl_append(bl);
+
+        if (!ent)
+            return ENOMEM;
+
+        *ent = pmt_bl_last.entv[i];
+    }
+
+    return 0;
+}
+
+SYSCTL_PROC(_debug_pmt, OID_AUTO, save,
+            CTLTYPE_STRING | CTLFLAG_RW,
+            NULL, 0, pmt_save_sysctl, "A",
+            "Save the results of the latest run as the named baseline");
+
+/* Load the baselines in the given text (modified in place), which has
+ * the format shown by debug.pmt.baseline:  One line per entry, each of
+ * the baseline name, test name, thread count, sweep ordering (or "-"),
+ * number of samples and the cost per call of each sample (in ps).  Each
+ * baseline named in the text replaces any existing one of that name.
+ * The text is parsed in full before any baseline is replaced, so that
+ * an error leaves all the baselines unchanged.
+ */
+static int
+pmt_bl_load(char *text)
+{
+    char *line, *next, *tokv[4 + PMT_STATS_MAX + 1];
+    pmt_bl_t loadv[PMT_BASELINES_MAX];
+    int tokc, nnew, nfree, n, b, i;
+    pmt_blent_t *ent;
+    pmt_bl_t *bl;
+    int rc = 0;
+
+    memset(loadv, 0, sizeof(loadv));
+
+    for (line = text; *line && !rc; line = next) {
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = '\000';
+        else
+            next = line + strlen(line);
+
+        for (tokc = 0; tokc < nitems(tokv); ) {
+            while (*line == ' ' || *line == '\t' || *line == '\r')
+                ++line;
+            if (!*line)
+                break;
+
+            tokv[tokc++] = line;
+
+            while (*line && *line != ' ' && *line != '\t' && *line != '\r')
+                ++line;
+            if (*line)
+                *line++ = '\000';
+        }
+
+        if (tokc == 0)
+            continue;
+
+        if (tokc < 5) {
+            rc = EINVAL;
+            break;
+        }
+
+        n = strtoul(tokv[4], NULL, 10);
+        if (n > PMT_STATS_MAX || tokc != 5 + n) {
+            rc = EINVAL;
+            break;
+        }
+
+        if (strlen(tokv[0]) >= sizeof(loadv[0].name) ||
+            strlen(tokv[1]) >= sizeof(ent->test) ||
+            strlen(tokv[3]) >= sizeof(ent->policy)) {
+            rc = ENAMETOOLONG;
+            break;
+        }
+
+        /* Find (or start) this text's baseline of the given name.
+         */
+        for (bl = loadv; bl < loadv + nitems(loadv); ++bl) {
+            if (!bl->name[0] || !strcmp(bl->name, tokv[0]))
+                break;
+        }
+
+        if (bl >= loadv + nitems(loadv)) {
+            rc = ENOSPC;
+            break;
+        }
+
+        strlcpy(bl->name, tokv[0], sizeof(bl->name));
+
+        ent = pmt_bl_append(bl);
+        if (!ent) {
+            rc = ENOMEM;
+            break;
+        }
+
+        strlcpy(ent->test, tokv[1], sizeof(ent->test));
+        ent->tds = strtoul(tokv[2], NULL, 10);
+        if (strcmp(tokv[3], "-"))
+            strlcpy(ent->policy, tokv[3], sizeof(ent->policy));
+
+        for (i = 0; i < n; ++i)
+            ent->costv[ent->n++] = strtoul(tokv[5 + i], NULL, 10);
+    }
+
+    /* Make sure there is room for the new baselines before replacing
+     * any of them.
+     */
+    if (!rc) {
+        nnew = nfree = 0;
+
+        for (b = 0; b < PMT_BASELINES_MAX; ++b) {
+            if (loadv[b].name[0] && !pmt_bl_lookup(loadv[b].name, 0))
+                ++nnew;
+            if (!pmt_blv[b].name[0])
+                ++nfree;
+        }
+
+        if (nnew > nfree)
+            rc = ENOSPC;
+    }
+
+    for (b = 0; b < PMT_BASELINES_MAX; ++b) {
+        if (rc || !loadv[b].name[0]) {
+            pmt_bl_clear(&loadv[b]);
+            continue;
+        }
+
+        bl = pmt_bl_lookup(loadv[b].name, 1);
+        pmt_bl_clear(bl);
+        *bl = loadv[b];
+    }
+
+    return rc;
+}
+
+/* Show all baselines as text, or load baselines from text (e.g., as
+ * saved from an earlier boot or another machine).
+ */
+static int
+pmt_baseline_sysctl(SYSCTL_HANDLER_ARGS)
+{
+    struct sbuf *sb;
+    size_t bufsz;
+    char *buf;
+    int rc, b, e, i;
+
+    sb = sbuf_new_auto();
+    if (!sb)
+        return ENOMEM;
+
+    for (b = 0; b < PMT_BASELINES_MAX; ++b) {
+        pmt_bl_t *bl = &pmt_blv[b];
+
+        for (e = 0; bl->name[0] && e < bl->entc; ++e) {
+            pmt_blent_t *ent = &bl->entv[e];
+
+            sbuf_printf(sb, "%s %s %d %s %d", bl->name, ent->test, ent->tds,
+                        ent->policy[0] ? ent->policy : "-", ent->n);
+            for (i = 0; i < ent->n; ++i)
+                sbuf_printf(sb, " %lu", ent->costv[i]);
+            sbuf_printf(sb, "\n");
+        }
+    }
+
+    sbuf_finish(sb);
+
+    bufsz = sbuf_len(sb) + 1;
+    if (req->newptr)
+        bufsz = MAX(bufsz, req->newlen + 1);
+
+    buf = malloc(bufsz, M_PMT, M_WAITOK);
+    if (!buf) {
+        sbuf_delete(sb);
+        return ENOMEM;
+    }
+
+    memcpy(buf, sbuf_data(sb), sbuf_len(sb) + 1);
+    sbuf_delete(sb);
+
+    rc = sysctl_handle_string(oidp, buf, bufsz, req);
+    if (!rc && req->newptr)
+        rc = pmt_bl_load(buf);
+
+    free(buf, M_PMT);
+
+    return rc;
+}
+
+SYSCTL_PROC(_debug_pmt, OID_AUTO, baseline,
+            CTLTYPE_STRING | CTLFLAG_RW,
+            NULL, 0, pmt_baseline_sysctl, "A",
+            "Saved baselines (one line per test: name test tds ordering n ps...)");
+
+static int
+pmt_compare_sysctl(SYSCTL_HANDLER_ARGS)
+{
+    return sysctl_handle_string(oidp, pmt_compare, sizeof(pmt_compare), req);
+}
+
+SYSCTL_PROC(_debug_pmt, OID_AUTO, compare,
+            CTLTYPE_STRING | CTLFLAG_RW,
+            NULL, 0, pmt_compare_sysctl, "A",
+            "Name of the baseline with which to compare each run (empty to not compare)");
+
+static int
+pmt_thresholds_sysctl(SYSCTL_HANDLER_ARGS)
+{
+    return sysctl_handle_string(oidp, pmt_thresholds, sizeof(pmt_thresholds), req);
+}
+
+SYSCTL_PROC(_debug_pmt, OID_AUTO, thresholds,
+            CTLTYPE_STRING | CTLFLAG_RW,
+            NULL, 0, pmt_thresholds_sysctl, "A",
+            "test:per-mille pairs overriding debug.pmt.threshold (e.g., \"mutex:20 spin:100\")");
+
+/* Return the threshold (per mille) of the given test.
+ */
+static u_int
+pmt_threshold_get(const char *name)
+{
+    size_t len = strlen(name);
+    char *cur;
+
+    for (cur = pmt_thresholds; (cur = strstr(cur, name)); cur += len) {
+        if ((cur == pmt_thresholds || cur[-1] == ' ') && cur[len] == ':')
+            return strtoul(cur + len + 1, NULL, 0);
+    }
+
+    return pmt_threshold;
+}
+
+/* Compare the results of the latest run with the baseline named by
+ * debug.pmt.compare, appending a table of the comparison of each test
+ * to sb (and to the structured results, if any).  A test regressed (or
+ * improved) if the Mann-Whitney U test finds its samples' costs per
+ * call differ from those of the baseline at significance level
+ * debug.pmt.alpha, and its median cost rose (or fell) by more than its
+ * threshold.
+ */
+static int
+pmt_compare_run(struct sbuf *sb)
+{
+    u_int regressions, improvements;
+    pmt_stats_t bstats, nstats;
+    pmt_bl_t *bl;
+    int nrec = 0;
+    int i;
+
+    pmt_regressions = 0;
+
+    bl = pmt_bl_lookup(pmt_compare, 0);
+    if (!bl) {
+        sbuf_printf(sb, "\nno baseline named %s\n", pmt_compare);
+        return ENOENT;
+    }
+
+    sbuf_printf(sb, "\nCOMPARE %s (alpha %u.%04u)\n", bl->name,
+                pmt_alpha / 10000, pmt_alpha % 10000);
+    sbuf_printf(sb, "%3s %8s %3s %3s %11s %11s %8s %6s %6s %-11s  %s\n",
+                "TDS", "ORDERING", "BN", "N", "BASE-MEDIAN", "MEDIAN",
+                "CHANGE", "Z", "P", "VERDICT", "NAME (ns/CALL)");
+
+    if (pmt_rec) {
+        pmt_rec_runs_end();
+
+        if (pmt_rec_json) {
+            sbuf_printf(pmt_rec, ",\n  \"compare\": {\"baseline\": ");
+            pmt_json_str(pmt_rec, bl->name);
+            sbuf_printf(pmt_rec, ", \"alpha_x10000\": %u, \"tests\": [", pmt_alpha);
+        } else {
+            sbuf_printf(pmt_rec, "# compare: %s\n", bl->name);
+        }
+    }
+
+    regressions = improvements = 0;
+
+    for (i = 0; i < pmt_bl_last.entc; ++i) {
+        pmt_blent_t *ent = &pmt_bl_last.entv[i];
+        pmt_blent_t *base = pmt_bl_find(bl, ent);
+        const char *verdict;
+        u_int p, z100, thresh;
+        long change;
+
+        if (!base || base->n < 1 || ent->n < 1) {
+            sbuf_printf(sb, "%3d %8s %3d %3d %11s %11s %8s %6s %6s %-11s  %s\n",
+                        ent->tds, ent->policy[0] ? ent->policy : "-",
+                        base ? base->n : 0, ent->n,
+                        "-", "-", "-", "-", "-",
+                        base && base->n > 0 ? "no samples" : "no baseline", ent->test);
+            continue;
+        }
+
+        pmt_stats_compute(base->costv, base->n, 0, NULL, &bstats);
+        pmt_stats_compute(ent->costv, ent->n, 0, NULL, &nstats);
+
+        change = (long)pmt_muldiv(nstats.median, 1000, MAX(bstats.median, 1)) - 1000;
+        p = pmt_mann_whitney(base->costv, base->n, ent->costv, ent->n, &z100);
+        thresh = pmt_threshold_get(ent->test);
+
+        verdict = "-";
+        if (p < pmt_alpha && change > (long)thresh) {
+            verdict = "REGRESSION";
+            ++regressions;
+        } else if (p < pmt_alpha && change < -(long)thresh) {
+            verdict = "improvement";
+            ++improvements;
+        }
+
+        sbuf_printf(sb, "%3d %8s %3d %3d %7lu.%03lu %7lu.%03lu %c%5lu.%lu%% "
+                    "%3u.%02u %u.%04u %-11s  %s\n",
+                    ent->tds, ent->policy[0] ? ent->policy : "-",
+                    base->n, ent->n,
+                    bstats.median / 1000, bstats.median % 1000,
+                    nstats.median / 1000, nstats.median % 1000,
+                    change < 0 ? '-' : '+',
+                    (u_long)(change < 0 ? -change : change) / 10,
+                    (u_long)(change < 0 ? -change : change) % 10,
+                    z100 / 100, z100 % 100,
+                    p / 10000, p % 10000,
+                    verdict, ent->test);
+
+        if (!pmt_rec)
+            continue;
+
+        if (pmt_rec_json) {
+            sbuf_printf(pmt_rec, "%s\n    {\"name\": ", nrec++ ? "," : "");
+            pmt_json_str(pmt_rec, ent->test);
+            sbuf_printf(pmt_rec, ", \"tds\": %d, \"policy\": ", ent->tds);
+            pmt_json_str(pmt_rec, ent->policy);
+            sbuf_printf(pmt_rec, ", \"base_median_ps\": %lu, \"median_ps\": %lu, "
+                        "\"change_x1000\": %ld, \"z_x100\": %u, \"p_x10000\": %u, "
+                        "\"threshold_x1000\": %u, \"verdict\": \"%s\"}",
+                        bstats.median, nstats.median, change, z100, p, thresh,
+                        verdict[0] == '-' ? "same" : verdict);
+        } else {
+            sbuf_printf(pmt_rec, "# compare: %s,%d,%s,%lu,%lu,%ld,%u,%u,%s\n",
+                        ent->test, ent->tds, ent->policy,
+                        bstats.median, nstats.median, change, z100, p,
+                        verdict[0] == '-' ? "same" : verdict);
+        }
+    }
+
+    sbuf_printf(sb, "%u regressions, %u improvements\n", regressions, improvements);
+
+    if (pmt_rec) {
+        if (pmt_rec_json)
+            sbuf_printf(pmt_rec, "],\n   \"regressions\": %u, \"improvements\": %u}",
+                        regressions, improvements);
+        else
+            sbuf_printf(pmt_rec, "# regressions: %u\n# improvements: %u\n",
+                        regressions, improvements);
+    }
+
+    pmt_regressions = regressions;
+
+    return 0;
+}
+
+/* Run each selected test on the given cpuset, appending the results to
+ * sb.  If ratesv is not NULL then the aggregate calls/s of each test is
+ * also stored in it (indexed by the test's position in tests[], and left
+ * unchanged for tests that weren't run).
+ */
+static int
+pmt_run_cpuset(cpuset_t *cpuset, struct sbuf *sb, u_long *ratesv)
+{
+    unsigned long cycles_baseline, nsecs_baseline;  // Per 1000 calls
+    pmt_wsample_t *wsamplesv;
+    pmt_sample_t *samplesv;
+    pmt_stats_t *statsv;
+    pmt_pmcres_t *pmcresv;
+    u_long offv[PMT_OFFSETS_MAX];
+    struct sbuf *sbbw, *sboff, *sbmix, *sbrole, *sbho, *sbwork;
+    pmt_role_t *rolev;
+    int rolec;
+    int workc;
+    int offc;
+    struct domainset *ds;
+    u_int pmcmask;
+    u_long shr_domains;
+    u_long *ratev;
+    size_t round, align;
+    size_t wsoff, wssz;
+    pmt_pool_t *pool;
+    pmt_test_t *test;
+    int samplesc, samplesmax;
+    size_t memsz;
+    int domain;
+    void *mem;
+    int rc, i;
+
+    cpusetobj_strprint(pmt_cpustr, cpuset);
+    pmt_cpuset_hex(pmt_cpumask, sizeof(pmt_cpumask), cpuset);
+    CPU_COPY(cpuset, &pmt_cpuset);
+
+    /* Ensure roundup and align are of an integral page size.
+     */
+    round = roundup(pmt_roundup, PAGE_SIZE);
+    align = roundup(pmt_align, PAGE_SIZE);
+
+    samplesmax = pmt_samples_max;
+    if (samplesmax < 2)
+        samplesmax = 2;
+    else if (samplesmax > PMT_STATS_MAX)
+        samplesmax = PMT_STATS_MAX;
+
+    samplesc = pmt_samples + 1;
+    if (samplesc < 2)
+        samplesc = 2;
+    else if (samplesc > samplesmax)
+        samplesc = samplesmax;
+
+    if (!pmt_ci_target)
+        samplesmax = samplesc;
+
+    /* Determine how much memory we need to run the test (each sample
+     * places its shared data pmt_samples_step bytes past the previous).
+     */
+    memsz = sizeof(pmt_share_t) + samplesmax * pmt_samples_step;
+
+    /* Make room for the shared data at each of the swept offsets.
+     */
+    offc = pmt_offsets_parse(offv, nitems(offv));
+
+    for (i = 0; i < offc; ++i)
+        memsz = MAX(memsz, offv[i] + sizeof(pmt_share_t));
+
+    /* Followed by room for the largest selected pointer chase or stream
+     * arrays.
+     */
+    wsoff = roundup(memsz, PAGE_SIZE);
+    wssz = 0;
+
+    for (test = tests; test->name; ++test) {
+        if (test->wss > pmt_chase_max || !pmt_tests_match(test->name))
+            continue;
+
+        wssz = MAX(wssz, pmt_test_wss(test, CPU_COUNT(cpuset)));
+    }
+
+    if (wssz > 0)
+        memsz = wsoff + wssz;
+
+    memsz = roundup(memsz, round);
+
+    /* Place the shared data relative to the domain of the first vCPU.
+     */
+    for (i = 0; !CPU_ISSET(i, cpuset); ++i)
+        continue;
+
+    domain = pcpu_find(i)->pc_domain;
+
+    switch (pmt_shr_domain) {
+    case PMT_DOMAIN_REMOTE:
+        ds = DOMAINSET_PREF((domain + 1) % vm_ndomains);
+        break;
+
+    case PMT_DOMAIN_INTERLEAVE:
+        ds = DOMAINSET_RR();
+        break;
+
+    default:
+        ds = DOMAINSET_PREF(domain);
+        break;
+    }
+
+    mem = contigmalloc_domainset(memsz, M_PMT, ds, M_NOWAIT,
+                                 0, ~(vm_paddr_t)0, align, 0);
+    if (!mem) {
+        printf("%s: unable to malloc %lu contiguous bytes\n", __func__, memsz);
+        return ENOMEM;
+    }
+
+    samplesv = malloc(sizeof(*samplesv) * samplesmax, M_PMT, M_NOWAIT | M_ZERO);
+    if (!samplesv) {
+        printf("%s: unable to malloc %lu bytes for samplesv\n",
+               __func__, sizeof(*samplesv) * samplesmax);
+        contigfree(mem, memsz, M_PMT);
+        return ENOMEM;
+    }
+
+    rc = pmt_pool_create(cpuset, &pool);
+    if (rc) {
+        free(samplesv, M_PMT);
+        contigfree(mem, memsz, M_PMT);
+        return rc;
+    }
+
+    if (wssz > 0)
+        pool->wsbase = (char *)mem + wsoff;
+
+    wsamplesv = malloc(sizeof(*wsamplesv) * samplesmax * pool->nworkers,
+                       M_PMT, M_WAITOK);
+    ratev = malloc(sizeof(*ratev) * pool->nworkers, M_PMT, M_WAITOK);
+    statsv = malloc(sizeof(*statsv) * nitems(tests), M_PMT, M_WAITOK | M_ZERO);
+    pmcresv = malloc(sizeof(*pmcresv) * nitems(tests), M_PMT, M_WAITOK | M_ZERO);
+    rolev = malloc(sizeof(*rolev) * PMT_ROLES_MAX, M_PMT, M_WAITOK | M_ZERO);
+
+    /* Assign each worker the test of the first role that names its vCPU.
+     */
+    rolec = pmt_roles_parse(rolev, PMT_ROLES_MAX);
+
+    /* Set the work parameters of the lock tests, calibrating the pause
+     * loop if need be.
+     */
+    workc = pmt_work_parse();
+    if (workc > 0)
+        pmt_pause_x1000 = pmt_work_calibrate();
+
+    for (i = 0; i < pool->nworkers; ++i) {
+        pmt_worker_t *worker = &pool->workerv[i];
+        int r;
+
+        worker->test = NULL;
+        worker->role = -1;
+
+        for (r = 0; r < rolec && !worker->test; ++r) {
+            if (pmt_roles_match(rolev[r].vcpus, worker->vcpu)) {
+                worker->test = rolev[r].test;
+                worker->role = r;
+            }
+        }
+    }
+
+    /* Only report the hardware counters that all workers could open.
+     */
+    pmcmask = ~0u;
+    for (i = 0; i < pool->nworkers; ++i)
+        pmcmask &= pool->workerv[i].pmc.mask;
+
+    for (i = 0; i < samplesmax; ++i)
+        samplesv[i].workerv = wsamplesv + i * pool->nworkers;
+
+    sbuf_printf(sb, "\n%16s %3s %12s %12s %12s %8s %12s %8s %10s %3s %7s %7s %7s  %s\n",
+                "vCPUMASK", "TDS", "CALLS", "CALLS/s",
+                "ns", "ns/CALL", "CYCLES", "CY/CALL",
+                "SKEW", "REJ", "MIN/MAX", "CV", "JAIN", "NAME");
+
+    pmt_rec_run(pool);
+
+    cycles_baseline = nsecs_baseline = 0;
+    shr_domains = 0;
+
+    sbbw = sbuf_new_auto();
+    sbuf_clear(sbbw);
+    sboff = sbuf_new_auto();
+    sbuf_clear(sboff);
+    sbmix = sbuf_new_auto();
+    sbuf_clear(sbmix);
+    sbrole = sbuf_new_auto();
+    sbuf_clear(sbrole);
+    sbho = sbuf_new_auto();
+    sbuf_clear(sbho);
+    sbwork = sbuf_new_auto();
+    sbuf_clear(sbwork);
+    rc = 0;
+
+    /* Run each test listed in pmt_tests[].
+     *
+     * TODO: Use a copy of pmt_tests[] so that we don't have to worry
+     * about it changing while we're running the tests.
+     */
+    for (test = tests; test->name; ++test) {
+        unsigned long cycles_avg, nsecs_avg, iters_avg;
+        pmt_stats_t *stats = &statsv[test - tests];
+        unsigned long skew_max;
+        int naccepted, nsamples, adjusted;
+        pmt_fair_t fair;
+        u_long iters;
+        int w;
+
+        if (!pmt_tests_match(test->name))
+            continue;
+
+        if (test->wss > pmt_chase_max || pmt_test_wss(test, pool->nworkers) > wssz)
+            continue;
+
+        if (test->roles && rolec < 1) {
+            if (rolec < 0)
+                sbuf_printf(sb, "%s invalid debug.pmt.roles\n", test->name);
+            continue;
+        }
+
+        if (test->work && workc < 0) {
+            sbuf_printf(sb, "%s invalid debug.pmt.work\n", test->name);
+            continue;
+        }
+
+        if (pmt_verbosity > 0)
+            printf("\n%s:\n", test->name);
+
+        if (test->wss > 0)
+            pmt_chase_build(pool->wsbase, test->wss);
+
+        /* Determine the number of iterations for each worker to run per
+         * sample (zero means run for pmt_duration milliseconds).
+         */
+        iters = pmt_iters;
+        rc = 0;
+
+        if (pmt_duration > 0) {
+            if (pmt_timed)
+                iters = 0;
+            else
+                rc = pmt_calibrate(test, pool, mem, memsz, samplesv, &iters);
+        }
+
+        if (!rc && offc > 0)
+            rc = pmt_offsets_sweep(sboff, test, pool, mem, memsz, iters,
+                                   samplesc, samplesv, offv, offc);
+
+        nsamples = samplesc;
+
+        if (!rc)
+            rc = pmt_run(test, pool, mem, memsz, 0, nsamples, iters, samplesv);
+
+        /* Keep taking samples one at a time until the confidence interval
+         * of the mean is narrow enough or we reach the sample cap.
+         */
+        while (!rc) {
+            pmt_evaluate(samplesv, nsamples, stats);
+
+            if (nsamples >= samplesmax)
+                break;
+
+            if (stats->n > 1 && stats->ci * 1000 <= stats->mean * pmt_ci_target)
+                break;
+
+            rc = pmt_run(test, pool, mem, memsz, nsamples, nsamples + 1,
+                         iters, samplesv);
+            ++nsamples;
+        }
+
+        if (rc) {
+            sbuf_printf(sb, "%s interrupted %d\n",
+                        test->name, rc);
+            break;
+        }
+
+        for (i = 0; i < nsamples; ++i)
+            shr_domains |= 1ul << (samplesv[i].domain % MAXMEMDOM);
+
+        if (pmt_verbosity > 0) {
+            printf("%4s %16s %12s %12s %12s %8s %12s %9s %10s %10s\n",
+                   "LOOP", "vCPUMASK", "CALLS", "CALLS/s",
+                   "ns", "ns/CALL", "CYCLES", "CY/CALL",
+                   "START-SKEW", "STOP-SKEW");
+
+            for (i = 0; i < nsamples; ++i)
+                pmt_print_sample(i, &samplesv[i]);
+        }
+
+        /* Discard the first sample and any samples rejected due to
+         * excessive start skew or as outliers, and average the rest.
+         */
+        nsecs_avg = iters_avg = cycles_avg = 0;
+        skew_max = 0;
+        naccepted = 0;
+
+        for (i = 1; i < nsamples; ++i) {
+            if (!pmt_sample_accepted(&samplesv[i]))
+                continue;
+
+            nsecs_avg += samplesv[i].delta;
+            iters_avg += samplesv[i].iters;
+            skew_max = MAX(skew_max, samplesv[i].start_skew);
+            ++naccepted;
+        }
+
+        if (naccepted < 1) {
+            pmt_rec_test(test, pool, nsamples, samplesv, stats, 0, 0, 0);
+            pmt_bl_record(test, pool, nsamples, samplesv);
+            continue;
+        }
+
+        nsecs_avg /= naccepted;
+        iters_avg /= naccepted;
+
+        /* Compute each worker's throughput over the accepted samples.
+         */
+        for (w = 0; w < pool->nworkers; ++w) {
+            unsigned long wdelta = 0, witers = 0;
+
+            for (i = 1; i < nsamples; ++i) {
+                if (!pmt_sample_accepted(&samplesv[i]))
+                    continue;
+
+                wdelta += samplesv[i].workerv[w].delta;
+                witers += samplesv[i].workerv[w].iters;
+            }
+
+            wdelta = pmt_delta2nsecs(wdelta);
+            ratev[w] = pmt_x1b_div_y(witers, wdelta ? wdelta : 1);
+        }
+
+        pmt_fairness(ratev, pool->nworkers, &fair);
+
+        if (test->bytes)
+            pmt_report_stream(sbbw, test, pool, ratev,
+                              pmt_x1b_div_y(iters_avg, pmt_delta2nsecs(nsecs_avg)));
+
+        if (test->write_ppm)
+            pmt_report_mix(sbmix, test, nsamples, samplesv);
+
+        pmt_report_handoff(sbho, test, nsamples, samplesv);
+
+        if (test->roles)
+            pmt_report_roles(sbrole, pool, rolev, rolec, nsamples, samplesv, ratev);
+
+        if (test->work)
+            pmt_report_work(sbwork, test);
+
+        if (pool->pmc)
+            pmt_pmc_sum(pool, nsamples, samplesv, &pmcresv[test - tests]);
+
+#ifdef PMT_TSC
+        cycles_avg = nsecs_avg;
+        nsecs_avg = pmt_cycles2nsecs(cycles_avg);
+#endif
+
+        /* Subtract the pmt framework overhead.  The baseline is kept per
+         * call since each test may run a different number of calls.  Tests
+         * with their own loop are measured directly.  A test that costs no
+         * more than the overhead has no averages to report.
+         */
+        adjusted = (iters_avg > 0);
+
+        if (adjusted && test->every && !test->loop) {
+            unsigned long cycles_overhead = pmt_muldiv(cycles_baseline, iters_avg, 1000);
+            unsigned long nsecs_overhead = pmt_muldiv(nsecs_baseline, iters_avg, 1000);
+
+            pmt_stats_subtract(stats, nsecs_baseline);
+
+            if (nsecs_avg <= nsecs_overhead || cycles_avg < cycles_overhead) {
+                adjusted = 0;
+            } else {
+                cycles_avg -= cycles_overhead;
+                nsecs_avg -= nsecs_overhead;
+            }
+        }
+
+        pmt_rec_test(test, pool, nsamples, samplesv, stats,
+                     adjusted ? iters_avg : 0, nsecs_avg, cycles_avg);
+        pmt_bl_record(test, pool, nsamples, samplesv);
+
+        if (!adjusted)
+            continue;
+
+        /* (Re)compute the baseline.  In order to work completely right this
+         * requires that the "null" test is run first, followed by the "func"
+         * test, followed by all other tests.
+         *
+         * TODO: Unconditionally run the "null" and "func" tests.
+         */
+        if (!test->loop && !test->roles &&
+            (!test->every || test->every == pmt_func_every)) {
+            cycles_baseline = pmt_muldiv(cycles_avg, 1000, iters_avg);
+            nsecs_baseline = pmt_muldiv(nsecs_avg, 1000, iters_avg);
+        }
+
+        if (ratesv)
+            ratesv[test - tests] = pmt_x1b_div_y(iters_avg, nsecs_avg);
+
+        sbuf_printf(sb, "%16s %3u %12lu %12lu %12lu %8lu %12lu %8lu %10lu %3d "
+                    "%3lu.%03lu %3lu.%03lu %3lu.%03lu  %s\n",
+                    pmt_cpumask,                            // vCPUMASK
+                    CPU_COUNT(cpuset),                      // TDS
+                    iters_avg,                              // CALLS
+                    pmt_x1b_div_y(iters_avg, nsecs_avg),    // CALLS/s
+                    nsecs_avg,                              // ns
+                    nsecs_avg / iters_avg,                  // ns/CALL
+                    cycles_avg,                             // CYCLES
+                    cycles_avg / iters_avg,                 // CY/CALL
+                    pmt_delta2nsecs(skew_max),              // SKEW
+                    nsamples - 1 - naccepted,               // REJ
+                    fair.minmax / 1000, fair.minmax % 1000, // MIN/MAX
+                    fair.cv / 1000, fair.cv % 1000,         // CV
+                    fair.jain / 1000, fair.jain % 1000,     // JAIN
+                    test->name);
+
+        if (pmt_pervcpu)
+            pmt_report_pervcpu(sb, test, pool, nsamples, samplesv);
+    }
+
+    if (sbuf_len(sboff) > 0) {
+        sbuf_finish(sboff);
+        sbuf_printf(sb, "\n%8s %8s %5s %3s %11s %11s %11s  %s\n",
+                    "OFFSET", "MTX-OFF", "SPLIT", "N",
+                    "MEDIAN", "MEAN", "CI95", "NAME (ns/CALL)");
+        sbuf_cat(sb, sbuf_data(sboff));
+    }
+    sbuf_delete(sboff);
+
+    if (sbuf_len(sbho) > 0) {
+        sbuf_finish(sbho);
+        sbuf_printf(sb, "\n%12s %12s %11s  %s\n",
+                    "HANDOFFS", "NO-SLEEP", "ns/HANDOFF", "NAME");
+        sbuf_cat(sb, sbuf_data(sbho));
+    }
+    sbuf_delete(sbho);
+
+    if (sbuf_len(sbwork) > 0) {
+        sbuf_finish(sbwork);
+        sbuf_printf(sb, "\nlock work at %lu.%03lu cycles per pause loop\n",
+                    pmt_pause_x1000 / 1000, pmt_pause_x1000 % 1000);
+        sbuf_printf(sb, "%9s %9s %8s %9s %9s %8s  %s\n",
+                    "CS-CY", "CS-SPINS", "CS-BYTES",
+                    "THINK-CY", "TH-SPINS", "TH-BYTES", "NAME");
+        sbuf_cat(sb, sbuf_data(sbwork));
+    }
+    sbuf_delete(sbwork);
+
+    if (sbuf_len(sbrole) > 0) {
+        sbuf_finish(sbrole);
+        sbuf_printf(sb, "\n%-16s %3s %12s %11s  %s\n",
+                    "ROLE vCPUs", "TDS", "CALLS/s", "ns/CALL", "NAME");
+        sbuf_cat(sb, sbuf_data(sbrole));
+    }
+    sbuf_delete(sbrole);
+
+    if (sbuf_len(sbmix) > 0) {
+        sbuf_finish(sbmix);
+        sbuf_printf(sb, "\n%7s %12s %12s %11s %11s  %s\n",
+                    "WRITE%", "READS", "WRITES", "ns/READ", "ns/WRITE", "NAME");
+        sbuf_cat(sb, sbuf_data(sbmix));
+    }
+    sbuf_delete(sbmix);
+
+    if (sbuf_len(sbbw) > 0) {
+        sbuf_finish(sbbw);
+        sbuf_printf(sb, "\n%11s %11s %11s %11s  %s\n",
+                    "GB/s", "MIN/THREAD", "AVG/THREAD", "MAX/THREAD", "NAME");
+        sbuf_cat(sb, sbuf_data(sbbw));
+    }
+    sbuf_delete(sbbw);
+
+    pmt_report_numa(sb, pool, shr_domains);
+
+    /* Append the statistics of the cost per call of each test.
+     */
+    sbuf_printf(sb, "\n%3s %3s %11s %11s %11s %11s %11s %11s  %s\n",
+                "N", "OUT", "MIN", "MEDIAN", "MEAN",
+                "STDDEV", "P90", "CI95", "NAME (ns/CALL)");
+
+    for (test = tests; test->name; ++test) {
+        pmt_stats_t *stats = &statsv[test - tests];
+
+        if (stats->n < 1)
+            continue;
+
+        sbuf_printf(sb, "%3d %3d %7lu.%03lu %7lu.%03lu %7lu.%03lu %7lu.%03lu "
+                    "%7lu.%03lu %7lu.%03lu  %s\n",
+                    stats->n,
+                    stats->noutliers,
+                    stats->min / 1000, stats->min % 1000,
+                    stats->median / 1000, stats->median % 1000,
+                    stats->mean / 1000, stats->mean % 1000,
+                    stats->stddev / 1000, stats->stddev % 1000,
+                    stats->p90 / 1000, stats->p90 % 1000,
+                    stats->ci / 1000, stats->ci % 1000,
+                    test->name);
+    }
+
+    if (pool->pmc)
+        pmt_report_pmc(sb, pmcresv, pmcmask, pool->workerv[0].pmc_rc);
+
+    pmt_rec_run_end();
+
+    pmt_pool_destroy(pool);
+    free(rolev, M_PMT);
+    free(pmcresv, M_PMT);
+    free(statsv, M_PMT);
+    free(ratev, M_PMT);
+    free(wsamplesv, M_PMT);
+    contigfree(mem, memsz, M_PMT);
+    free(samplesv, M_PMT);
+
+    return rc;
+}
+
+
+static int
+pmt_cpuset_first(const cpuset_t *set)
+{
+    int i;
+
+    for (i = 0; i < MAXCPU; ++i) {
+        if (CPU_ISSET(i, set))
+            return i;
+    }
+
+    return 0;
+}
+
+/* Find the core (i.e., its first vCPU) and package (i.e., its first vCPU)
+ * of the given vCPU.  A vCPU that shares no L1 with a sibling is its own
+ * core, and all vCPUs are in package 0 unless the topology has more than
+ * one package.
+ */
+static void
+pmt_topo_find(int vcpu, int *corep, int *pkgp)
+{
+    struct cpu_group *cg, *root;
+    int i;
+
+    *corep = vcpu;
+    *pkgp = 0;
+
+    root = cg = smp_topo();
+
+    while (cg && CPU_ISSET(vcpu, &cg->cg_mask)) {
+        if (cg->cg_level == CG_SHARE_L1 || (cg->cg_flags & CG_FLAG_SMT)) {
+            *corep = pmt_cpuset_first(&cg->cg_mask);
+            break;
+        }
+
+        if (cg->cg_parent == root && root->cg_level == CG_SHARE_NONE)
+            *pkgp = pmt_cpuset_first(&cg->cg_mask);
+
+        for (i = 0; i < cg->cg_children; ++i) {
+            if (CPU_ISSET(vcpu, &cg->cg_child[i].cg_mask))
+                break;
+        }
+
+        cg = (i < cg->cg_children) ? &cg->cg_child[i] : NULL;
+    }
+}
+
+/* Order the vCPUs of the given cpuset by the given sweep policy, such
+ * that the first n vCPUs of vcpuv[] are the vCPUs to use to run n threads.
+ * Returns the number of vCPUs in vcpuv[].
+ */
+static int
+pmt_sweep_order(const cpuset_t *cpuset, int policy, int *vcpuv)
+{
+    struct {
+        int         vcpu;
+        int         core;
+        int         pkg;
+        u_int       rank;       // Sibling index of vcpu within its core
+        u_int       corerank;   // Core index within its package
+        uint64_t    key;
+    } *topov, tmp;
+    int n, i, j;
+
+    topov = malloc(sizeof(*topov) * MAXCPU, M_PMT, M_WAITOK | M_ZERO);
+    if (!topov)
+        return 0;
+
+    for (n = i = 0; i < MAXCPU; ++i) {
+        if (!CPU_ISSET(i, cpuset))
+            continue;
+
+        topov[n].vcpu = i;
+        pmt_topo_find(i, &topov[n].core, &topov[n].pkg);
+        ++n;
+    }
+
+    for (i = 0; i < n; ++i) {
+        for (j = 0; j < i; ++j) {
+            if (topov[j].core == topov[i].core)
+                ++topov[i].rank;
+        }
+    }
+
+    for (i = 0; i < n; ++i) {
+        for (j = 0; j < n; ++j) {
+            if (topov[j].rank == 0 && topov[j].pkg == topov[i].pkg &&
+                topov[j].core < topov[i].core)
+                ++topov[i].corerank;
+        }
+    }
+
+    /* Sort by a key of up to three 16-bit fields above the vCPU.
+     */
+    for (i = 0; i < n; ++i) {
+        uint64_t a, b, c;
+
+        switch (policy) {
+        case 0:
+            a = topov[i].pkg, b = topov[i].core, c = 0;
+            break;
+
+        case 1:
+            a = topov[i].rank, b = topov[i].pkg, c = topov[i].corerank;
+            break;
+
+        case 2:
+            a = topov[i].rank, b = topov[i].corerank, c = topov[i].pkg;
+            break;
+
+        default:
+            a = topov[i].pkg, b = topov[i].rank, c = topov[i].corerank;
+            break;
+        }
+
+        topov[i].key = (a << 48) | (b << 32) | (c << 16) | topov[i].vcpu;
+    }
+
+    for (i = 1; i < n; ++i) {
+        tmp = topov[i];
+
+        for (j = i; j > 0 && topov[j - 1].key > tmp.key; --j)
+            topov[j] = topov[j - 1];
+
+        topov[j] = tmp;
+    }
+
+    for (i = 0; i < n; ++i)
+        vcpuv[i] = topov[i].vcpu;
+
+    free(topov, M_PMT);
+
+    return n;
+}
+
+/* Append the scaling curve of each test run by the given sweep, along
+ * with the throughput predicted by a Universal Scalability Law fit of
+ * the curve and a table of the fitted parameters.  ratesv[] holds the
+ * aggregate calls/s of each test at each thread count in tdsv[] (ntests
+ * per thread count).
+ */
+static void
+pmt_report_sweep(struct sbuf *sb, const char *policy, const int *vcpuv, int vcpuc,
+                 const int *tdsv, int tdsc, const u_long *ratesv, int ntests)
+{
+    uint64_t ratev[PMT_SWEEP_MAX];
+    u_int nv[PMT_SWEEP_MAX];
+    struct sbuf *sbusl;
+    pmt_test_t *test;
+    pmt_usl_t usl;
+    int i, k;
+
+    sbusl = sbuf_new_auto();
+    if (!sbusl)
+        return;
+
+    sbuf_printf(sb, "\nSWEEP %s, vCPU order:", policy);
+    for (i = 0; i < vcpuc; ++i)
+        sbuf_printf(sb, "%s%d", i ? "," : " ", vcpuv[i]);
+
+    sbuf_printf(sb, "\n%3s %12s %12s %12s %11s  %s\n",
+                "TDS", "CALLS/s", "USL CALLS/s", "CALLS/s/TD", "SPEEDUP", "NAME");
+
+    for (test = tests; test->name; ++test) {
+        u_long base = ratesv[test - tests];
+
+        if (base == 0)
+            continue;
+
+        for (k = 0; k < tdsc; ++k) {
+            nv[k] = tdsv[k];
+            ratev[k] = ratesv[k * ntests + (test - tests)];
+        }
+
+        pmt_usl_fit(nv, ratev, tdsc, &usl);
+
+        for (k = 0; k < tdsc; ++k) {
+            u_long rate = ratev[k];
+            u_long speedup = pmt_muldiv(rate, 1000, base);
+
+            sbuf_printf(sb, "%3d %12lu %12lu %12lu %7lu.%03lu  %s\n",
+                        tdsv[k], rate,
+                        usl.n ? pmt_usl_predict(&usl, nv[k]) : 0,
+                        rate / tdsv[k],
+                        speedup / 1000, speedup % 1000,
+                        test->name);
+        }
+
+        if (usl.n < 1)
+            continue;
+
+        sbuf_printf(sbusl, "%3d %c%lu.%06lu %c%lu.%06lu %c%lu.%03lu ",
+                    usl.n,
+                    usl.sigma < 0 ? '-' : ' ',
+                    (u_long)(usl.sigma < 0 ? -usl.sigma : usl.sigma) / 1000000,
+                    (u_long)(usl.sigma < 0 ? -usl.sigma : usl.sigma) % 1000000,
+                    usl.kappa < 0 ? '-' : ' ',
+                    (u_long)(usl.kappa < 0 ? -usl.kappa : usl.kappa) / 1000000,
+                    (u_long)(usl.kappa < 0 ? -usl.kappa : usl.kappa) % 1000000,
+                    usl.r2 < 0 ? '-' : ' ',
+                    (u_long)(usl.r2 < 0 ? -usl.r2 : usl.r2) / 1000,
+                    (u_long)(usl.r2 < 0 ? -usl.r2 : usl.r2) % 1000);
+
+        if (usl.peak_n > 0)
+            sbuf_printf(sbusl, "%7lu.%lu ", usl.peak_n / 1000, (usl.peak_n % 1000) / 100);
+        else
+            sbuf_printf(sbusl, "%9s ", "-");
+
+        if (usl.peak_x > 0)
+            sbuf_printf(sbusl, "%12lu  %s\n", usl.peak_x, test->name);
+        else
+            sbuf_printf(sbusl, "%12s  %s\n", "-", test->name);
+    }
+
+    if (sbuf_len(sbusl) > 0) {
+        sbuf_finish(sbusl);
+        sbuf_printf(sb, "\n%3s %9s %9s %6s %9s %12s  %s\n",
+                    "N", "SIGMA", "KAPPA", "R2", "PEAK-TDS", "PEAK-CALLS/s", "NAME (USL)");
+        sbuf_cat(sb, sbuf_data(sbusl));
+    }
+    sbuf_delete(sbusl);
+}
+
+/* Run the selected tests at 1, 2, 4, ... N threads for each vCPU ordering
+ * given by debug.pmt.sweep, where N is the number of vCPUs in the cpuset.
+ * The results of each individual run are shown on the console only at
+ * verbosity 2 or higher.
+ */
+static int
+pmt_run_sweep(cpuset_t *cpuset, struct sbuf *sb)
+{
+    int tdsv[PMT_SWEEP_MAX];
+    struct sbuf *sbrun;
+    u_long *ratesv;
+    cpuset_t subset;
+    int vcpuc, tdsc, tds;
+    int ntests;
+    int *vcpuv;
+    int rc, p, k, i;
+
+    ntests = nitems(tests);
+
+    ratesv = malloc(sizeof(*ratesv) * ntests * PMT_SWEEP_MAX, M_PMT, M_WAITOK);
+    vcpuv = malloc(sizeof(*vcpuv) * MAXCPU, M_PMT, M_WAITOK);
+    sbrun = sbuf_new_auto();
+
+    if (!ratesv || !vcpuv || !sbrun) {
+        if (sbrun)
+            sbuf_delete(sbrun);
+        free(vcpuv, M_PMT);
+        free(ratesv, M_PMT);
         return ENOMEM;
     }
 
-    samplesv = malloc(sizeof(*samplesv) * samplesc, M_PMT, M_NOWAIT);
-    if (!samplesv) {
-        printf("%s: unable to malloc %lu bytes for samplesv\n",
-               __func__, sizeof(*samplesv) * samplesc);
-        contigfree(mem, memsz, M_PMT);
+    rc = 0;
+
+    for (p = 0; p < nitems(pmt_sweep_policyv) && !rc; ++p) {
+        if (!strstr(pmt_sweep, pmt_sweep_policyv[p]))
+            continue;
+
+        pmt_sweep_policy = pmt_sweep_policyv[p];
+
+        vcpuc = pmt_sweep_order(cpuset, p, vcpuv);
+        if (vcpuc < 1) {
+            rc = ENOMEM;
+            break;
+        }
+
+        for (tdsc = 0, tds = 1; tdsc < PMT_SWEEP_MAX; tds = MIN(tds * 2, vcpuc)) {
+            tdsv[tdsc++] = tds;
+            if (tds == vcpuc)
+                break;
+        }
+
+        memset(ratesv, 0, sizeof(*ratesv) * ntests * PMT_SWEEP_MAX);
+
+        for (k = 0; k < tdsc; ++k) {
+            CPU_ZERO(&subset);
+            for (i = 0; i < tdsv[k]; ++i)
+                CPU_SET(vcpuv[i], &subset);
+
+            sbuf_clear(sbrun);
+
+            rc = pmt_run_cpuset(&subset, sbrun, ratesv + k * ntests);
+            if (rc)
+                break;
+
+            if (pmt_verbosity > 1) {
+                sbuf_finish(sbrun);
+                printf("%s", sbuf_data(sbrun));
+            }
+        }
+
+        if (k > 0)
+            pmt_report_sweep(sb, pmt_sweep_policyv[p], vcpuv, vcpuc,
+                             tdsv, k, ratesv, ntests);
+    }
+
+    pmt_sweep_policy = NULL;
+
+    sbuf_delete(sbrun);
+    free(vcpuv, M_PMT);
+    free(ratesv, M_PMT);
+
+    return rc;
+}
+
+static int
+pmt_run_sysctl(SYSCTL_HANDLER_ARGS)
+{
+    char cpustr[CPUSETBUFSIZ];
+    struct sbuf *sb;
+    cpuset_t cpuset;
+    int rc;
+
+    cpusetobj_strprint(cpustr, &pmt_cpuset);
+
+    rc = sysctl_handle_string(oidp, cpustr, sizeof(cpustr), req);
+    if (rc || !req->newptr)
+        return rc;
+
+    rc = pmt_cpuset_scan(cpustr, &cpuset);
+    if (rc)
+        return rc;
+
+    sb = sbuf_new_auto();
+    if (!sb)
         return ENOMEM;
+
+    sbuf_clear(sb);
+
+    rc = pmt_rec_begin(&cpuset);
+    if (rc) {
+        sbuf_delete(sb);
+        return rc;
     }
 
-    sbuf_printf(sb, "\n%16s %3s %12s %12s %12s %8s %12s %8s  %s\n",
-                "vCPUMASK", "TDS", "CALLS", "CALLS/s",
-                "ns", "ns/CALL", "CYCLES", "CY/CALL", "NAME");
+    pmt_bl_clear(&pmt_bl_last);
 
-    cycles_baseline = nsecs_baseline = 0;
-    rc = 0;
+    if (pmt_sweep[0]) {
+        rc = pmt_run_sweep(&cpuset, sb);
+
+        cpusetobj_strprint(pmt_cpustr, &cpuset);
+        pmt_cpuset_hex(pmt_cpumask, sizeof(pmt_cpumask), &cpuset);
+        CPU_COPY(&cpuset, &pmt_cpuset);
+    } else {
+        rc = pmt_run_cpuset(&cpuset, sb, NULL);
+    }
+
+    if (!rc && pmt_compare[0])
+        rc = pmt_compare_run(sb);
+
+    sbuf_finish(sb);
+
+    if (pmt_rec) {
+        pmt_rec_end();
+        pmt_results_set(pmt_rec);
+        sbuf_delete(pmt_rec);
+        pmt_rec = NULL;
+    } else {
+        pmt_results_set(sb);
+    }
+
+    sbuf_delete(sb);
+
+    /* Fail the write once the results are set, so that sysctl(8)
+     * exits non-zero if the run regressed from the compared baseline.
+     */
+    if (!rc && pmt_compare[0] && pmt_regressions > 0)
+        rc = PMT_EREGRESS;
+
+    return rc;
+}
+
+SYSCTL_PROC(_debug_pmt, OID_AUTO, run,
+            CTLTYPE_STRING | CTLFLAG_RW,
+            NULL, 0, pmt_run_sysctl, "",
+            "Run the pmt test loop");
+
+
+/* Append an NxN matrix of the given latencies (in ps, indexed by the
+ * positions of the vCPUs in vcpuv) to the results, in ns.
+ */
+static void
+pmt_report_c2c(struct sbuf *sb, const char *title, const int *vcpuv, int n,
+               const u_long *latv, u_long scale)
+{
+    int i, j;
+
+    sbuf_printf(sb, "\n%s\n%5s", title, "vCPU");
+    for (j = 0; j < n; ++j)
+        sbuf_printf(sb, " %7d", vcpuv[j]);
+    sbuf_printf(sb, "\n");
+
+    for (i = 0; i < n; ++i) {
+        sbuf_printf(sb, "%5d", vcpuv[i]);
+
+        for (j = 0; j < n; ++j) {
+            u_long lat = latv[i * n + j] * scale;
+
+            if (i == j)
+                sbuf_printf(sb, " %7s", "-");
+            else
+                sbuf_printf(sb, " %5lu.%lu", lat / 1000, (lat % 1000) / 100);
+        }
+
+        sbuf_printf(sb, "\n");
+    }
+}
+
+/* Measure the cache line transfer latency between each pair of vCPUs in
+ * the given set by running the ping-pong test on a pool of just the two
+ * of them, and then show the one-way and round trip latencies as NxN
+ * matrices in the results.  The latency of each pair is the median of
+ * its samples (less the first).
+ */
+static int
+pmt_c2c_sysctl(SYSCTL_HANDLER_ARGS)
+{
+    static char cpustr[CPUSETBUFSIZ];
+    pmt_test_t pingtest = {
+        .name = "pingpong",
+        .every = pmt_pingpong_every,
+    };
+    pmt_test_t pongtest = {
+        .name = "pongping",
+        .every = pmt_pongping_every,
+    };
+    pmt_wsample_t *wsamplesv;
+    pmt_sample_t *samplesv;
+    cpuset_t cpuset, pair;
+    pmt_pool_t *pool = NULL;
+    pmt_stats_t stats;
+    struct sbuf *sb;
+    int *vcpuv, n, i, j;
+    int samplesc;
+    u_long *latv;
+    size_t memsz;
+    void *mem;
+    int rc;
+
+    rc = sysctl_handle_string(oidp, cpustr, sizeof(cpustr), req);
+    if (rc || !req->newptr)
+        return rc;
+
+    rc = pmt_cpuset_scan(cpustr, &cpuset);
+    if (rc)
+        return rc;
 
-    /* Run each test listed in pmt_tests[].
-     *
-     * TODO: Use a copy of pmt_tests[] so that we don't have to worry
-     * about it changing while we're running the tests.
-     */
-    for (test = tests; test->name; ++test) {
-        unsigned long cycles_avg, nsecs_avg, iters_avg;
-        int i;
+    n = CPU_COUNT(&cpuset);
+    if (n < 2)
+        return EINVAL;
 
-        if (!strstr(pmt_tests, test->name))
-            continue;
+    samplesc = pmt_samples + 1;
+    if (samplesc < 2)
+        samplesc = 2;
+    else if (samplesc > PMT_STATS_MAX)
+        samplesc = PMT_STATS_MAX;
 
-        rc = pmt_run(test, mem, memsz, samplesc, samplesv);
-        if (rc) {
-            sbuf_printf(sb, "%s interrupted %d\n",
-                        test->name, rc);
-            break;
-        }
+    memsz = roundup(sizeof(pmt_share_t) + samplesc * pmt_samples_step, PAGE_SIZE);
 
-        /* Discard the first smaple and average the rest.
-         */
-        nsecs_avg = iters_avg = cycles_avg = 0;
+    mem = contigmalloc(memsz, M_PMT, M_NOWAIT, 0, ~(vm_paddr_t)0, PAGE_SIZE, 0);
+    if (!mem) {
+        printf("%s: unable to malloc %lu contiguous bytes\n", __func__, memsz);
+        return ENOMEM;
+    }
 
-        for (i = 1; i < samplesc; ++i) {
-            nsecs_avg += samplesv[i].delta;
-            iters_avg += samplesv[i].iters;
-        }
+    sb = sbuf_new_auto();
+    samplesv = malloc(sizeof(*samplesv) * samplesc, M_PMT, M_WAITOK | M_ZERO);
+    wsamplesv = malloc(sizeof(*wsamplesv) * samplesc * 2, M_PMT, M_WAITOK);
+    vcpuv = malloc(sizeof(*vcpuv) * n, M_PMT, M_WAITOK);
+    latv = malloc(sizeof(*latv) * n * n, M_PMT, M_WAITOK | M_ZERO);
 
-        nsecs_avg /= (samplesc - 1);
-        iters_avg /= (samplesc - 1);
+    for (i = 0; i < samplesc; ++i)
+        samplesv[i].workerv = wsamplesv + i * 2;
 
-#ifdef PMT_TSC
-        cycles_avg = nsecs_avg;
-        nsecs_avg = pmt_cycles2nsecs(cycles_avg);
-#endif
+    for (i = j = 0; i < MAXCPU; ++i) {
+        if (CPU_ISSET(i, &cpuset))
+            vcpuv[j++] = i;
+    }
 
-        if (nsecs_avg <= nsecs_baseline || cycles_avg < cycles_baseline || iters_avg < 1)
-            continue;
+    /* Create one worker per vCPU up front, and then select the two
+     * workers of each pair in turn.
+     */
+    rc = pmt_pool_create(&cpuset, &pool);
 
-        /* Subtract the pmt framework overhead.
-         */
-        if (test->every) {
-            cycles_avg -= cycles_baseline;
-            nsecs_avg -= nsecs_baseline;
+    /* Each pair is run twice, once with each vCPU of the pair pinging,
+     * so that the matrices needn't be symmetric.
+     */
+    for (i = 0; i < n && !rc; ++i) {
+        for (j = 0; j < n && !rc; ++j) {
+            if (i == j)
+                continue;
+
+            CPU_ZERO(&pair);
+            CPU_SET(vcpuv[i], &pair);
+            CPU_SET(vcpuv[j], &pair);
+
+            pmt_pool_select(pool, &pair);
+
+            /* The pool orders its workers by vCPU, so pick the test
+             * in which the worker on vcpuv[i] pings.
+             */
+            rc = pmt_run((vcpuv[i] < vcpuv[j]) ? &pingtest : &pongtest,
+                         pool, mem, memsz, 0, samplesc,
+                         pmt_c2c_iters, samplesv);
+            if (rc)
+                break;
+
+            /* Each sample's cost per call is half a round trip since
+             * both workers count each round trip.
+             */
+            pmt_evaluate(samplesv, samplesc, &stats);
+            latv[i * n + j] = stats.median;
         }
+    }
 
-        /* (Re)compute the baseline.  In order to work completely right this
-         * requires that the "null" test is run first, followed by the "func"
-         * test, followed by all other tests.
-         *
-         * TODO: Unconditionally run the "null" and "func" tests.
-         */
-        if (!test->every || test->every == pmt_func_every) {
-            cycles_baseline = cycles_avg;
-            nsecs_baseline = nsecs_avg;
-        }
+    if (pool)
+        pmt_pool_destroy(pool);
 
-        sbuf_printf(sb, "%016lx %3u %12lu %12lu %12lu %8lu %12lu %8lu  %s\n",
-                    pmt_cpuset.__bits[0],                   // vCPUMASK
-                    CPU_COUNT(&cpuset),                     // TDS
-                    iters_avg,                              // CALLS
-                    pmt_x1b_div_y(iters_avg, nsecs_avg),    // CALLS/s
-                    //(iters_avg * 1000000000ul) / nsecs_avg, // CALLS/s
-                    nsecs_avg,                              // ns
-                    nsecs_avg / iters_avg,                  // ns/CALL
-                    cycles_avg,                             // CYCLES
-                    cycles_avg / iters_avg,                 // CY/CALL
-                    test->name);
+    if (rc) {
+        sbuf_printf(sb, "c2c interrupted %d\n", rc);
+    } else {
+        pmt_report_c2c(sb, "ONE-WAY LATENCY (ns, row vCPU pings column vCPU)",
+                       vcpuv, n, latv, 1);
+        pmt_report_c2c(sb, "ROUND TRIP LATENCY (ns, row vCPU pings column vCPU)",
+                       vcpuv, n, latv, 2);
     }
 
     sbuf_finish(sb);
-    strlcpy(pmt_results, sbuf_data(sb), sizeof(pmt_results));
+    pmt_results_set(sb);
     sbuf_delete(sb);
 
-    contigfree(mem, memsz, M_PMT);
+    free(latv, M_PMT);
+    free(vcpuv, M_PMT);
+    free(wsamplesv, M_PMT);
     free(samplesv, M_PMT);
+    contigfree(mem, memsz, M_PMT);
 
     return rc;
 }
 
-SYSCTL_PROC(_debug_pmt, OID_AUTO, run,
+SYSCTL_PROC(_debug_pmt, OID_AUTO, c2c,
             CTLTYPE_STRING | CTLFLAG_RW,
-            NULL, 0, pmt_run_sysctl, "",
-            "Run the pmt test loop");
+            NULL, 0, pmt_c2c_sysctl, "",
+            "Measure the cache line transfer latency between each pair of vCPUs");
 
 
 static int
 pmt_results_sysctl(SYSCTL_HANDLER_ARGS)
 {
-    return sysctl_handle_string(oidp, pmt_results, strlen(pmt_results) + 1, req);
+    char *results = pmt_results ? pmt_results : "";
+
+    return sysctl_handle_string(oidp, results, strlen(results) + 1, req);
 }
 
 SYSCTL_PROC(_debug_pmt, OID_AUTO, results,
@@ -450,242 +3820,507 @@ SYSCTL_PROC(_debug_pmt, OID_AUTO, results,
             "Show pmt run results");
 
 
-/* This is the "main" routine for each thread created by pmt_run().
+/* Spin until all workers have arrived at the barrier.  The last worker
+ * to arrive resets the count and then releases all the spinners by
+ * flipping the barrier's sense.
  */
 static void
-pmt_run_main(void *arg)
+pmt_barrier_wait(pmt_barrier_t *barrier, u_int *sensep)
 {
-    struct thread *td = curthread;
-    pmt_priv_t *priv = arg;
-    pmt_test_cb_t *every;
-    unsigned int iters;
-    pmt_share_t *shr;
-    int rc;
+    u_int sense = !*sensep;
 
-    if (!priv || !priv->shr) {
-        printf("%s: priv or priv->shr is nil priv=%p priv->shr=%p\n",
-               __func__, priv, priv->shr);
-        kthread_exit();
-    }
+    *sensep = sense;
 
-    /* Affine this thread to the given vCPU.
-     */
-    rc = cpuset_setthread(td->td_tid, &priv->vcpu_mask);
-    if (rc) {
-        printf("%s: cpuset_setthread() failed: rc=%d vcpu=%d\n",
-               __func__, rc, priv->vcpu);
-        kthread_exit();
+    if (1 == atomic_fetchadd_int(&barrier->count, -1)) {
+        barrier->count = barrier->nworkers;
+        atomic_store_rel_int(&barrier->sense, sense);
+        return;
     }
 
+    while (atomic_load_acq_int(&barrier->sense) != sense)
+        cpu_spinwait();
+}
+
+
+/* Run one sample of the test on the calling worker thread.
+ */
+static void
+pmt_run_sample(pmt_worker_t *worker, pmt_priv_t *priv)
+{
+    pmt_pool_t *pool = worker->pool;
+    pmt_test_loop_t *loop;
+    pmt_test_cb_t *every;
+    pmt_share_t *shr;
+    u_long iters;
+
     every = priv->every;
-    iters = pmt_iters;
+    loop = priv->loop;
+    iters = pool->iters;
     shr = priv->shr;
 
-    /* Wait here for pmt_run() to signal us, which won't happen until all
-     * worker threads have arrived at this point and called cv_wait().
-     */
-    mtx_lock(&shr->mtx);
-    ++shr->nwaiting;
-    cv_wait_unlock(&shr->cv, &shr->mtx);
-
-    /* Busy wait to synchronize all threads that have awakened.
+    /* Spin until all the workers have awakened, then go.
      */
-#ifdef PMT_TSC
-    while (rdtsc() < shr->sync)
-        ;
-#else
-    while (getnanotime() < shr->sync)
-        ;
-#endif
+    pmt_barrier_wait(&pool->barrier, &worker->sense);
 
-    /* First thread to increment nrunning records the start time.
-     */
-    if (0 == atomic_fetchadd_int(&shr->nrunning, 1)) {
-#ifdef PMT_TSC
-        shr->start = rdtsc();
-#else
-        struct timespec ts_start;
+    if (pool->pmc)
+        pmt_pmc_start(&worker->pmc);
 
-        getnanotime(&ts_start);
-        shr->start = ts_start.tv_sec * 1000000000L + ts_start.tv_nsec;
-#endif
-    }
+    priv->start = pmt_now();
 
-#ifdef PMT_BEFORE
     if (priv->before) {
         priv->before(shr, priv);
     }
-#endif
 
     /* Run the test iteration.
      *
      * Note:  In our attempt to measure the cost of the framework
      * we want to run the loop even if 'every' is NULL.
      */
-    while (iters-- > 0) {
-        if (every) {
-            every(shr, priv);
+    if (loop) {
+        priv->iters = loop(shr, priv, iters, &pool->stop);
+    } else if (iters > 0) {
+        priv->iters = iters;
+
+        while (iters-- > 0) {
+            if (every) {
+                every(shr, priv);
+            }
+        }
+    } else {
+        while (!pool->stop) {
+            if (every) {
+                every(shr, priv);
+            }
+            ++iters;
         }
+
+        priv->iters = iters;
     }
 
-#ifdef PMT_AFTER
     if (priv->after) {
         priv->after(shr, priv);
     }
-#endif
 
-    /* Last thread out records the stop time and signals the master
-     * thread waiting in pmt_run().
+    priv->stop = pmt_now();
+
+    if (pool->pmc)
+        pmt_pmc_stop(&worker->pmc, worker->pmcv);
+}
+
+
+/* This is the "main" routine for each thread created by pmt_pool_create().
+ * The worker affines itself to its vCPU once, and then parks until either
+ * pmt_run() hands it a sample to run or the pool is destroyed.
+ */
+static void
+pmt_run_main(void *arg)
+{
+    struct thread *td = curthread;
+    pmt_worker_t *worker = arg;
+    pmt_pool_t *pool;
+    u_int gen;
+    int rc;
+
+    pool = worker->pool;
+    gen = 0;
+
+    /* Affine this thread to the given vCPU.
      */
-    if (1 == atomic_fetchadd_int(&shr->nrunning, -1)) {
-#ifdef PMT_TSC
-        shr->stop = rdtsc();
-#else
-        struct timespec ts_stop;
+    rc = cpuset_setthread(td->td_tid, &worker->vcpu_mask);
+    if (rc) {
+        printf("%s: cpuset_setthread() failed: rc=%d vcpu=%d\n",
+               __func__, rc, worker->vcpu);
+    }
 
-        getnanotime(&ts_stop);
-        shr->stop = ts_stop.tv_sec * 1000000000L + ts_stop.tv_nsec;
-#endif
+    /* Open the hardware counters only after affining, so that they are
+     * opened on our vCPU.  Failure to open them isn't fatal.
+     */
+    if (pool->pmc)
+        worker->pmc_rc = pmt_pmc_open(&worker->pmc, pmt_pmc_hitm);
+
+    mtx_lock(&pool->mtx);
+    worker->rc = rc;
+    ++pool->nready;
+    cv_broadcast(&pool->donecv);
+
+    while (!rc) {
+        while (pool->gen == gen && !pool->exiting)
+            cv_wait(&pool->cv, &pool->mtx);
+
+        if (pool->exiting)
+            break;
+
+        gen = pool->gen;
+        if (!worker->selected)
+            continue;
+
+        mtx_unlock(&pool->mtx);
 
-        mtx_lock(&shr->mtx);
-        cv_broadcast(&shr->cv);
-        mtx_unlock(&shr->mtx);
+        pmt_run_sample(worker, worker->priv);
+
+        /* Last worker done with the sample wakes pmt_run().
+         */
+        mtx_lock(&pool->mtx);
+        if (++pool->ndone == pool->nrun)
+            cv_broadcast(&pool->donecv);
     }
 
+    if (pool->pmc)
+        pmt_pmc_close(&worker->pmc);
+
+    ++pool->nexited;
+    cv_broadcast(&pool->donecv);
+    mtx_unlock(&pool->mtx);
+
     kthread_exit();
 }
 
 
+/* Create and affine one worker thread for each vCPU in the given set,
+ * and wait for them all to park.
+ */
+static int
+pmt_pool_create(cpuset_t *cpuset, pmt_pool_t **poolp)
+{
+    pmt_worker_t *worker;
+    pmt_pool_t *pool;
+    size_t sz;
+    int rc, i;
+
+    sz = sizeof(*pool) + sizeof(pool->workerv[0]) * CPU_COUNT(cpuset);
+
+    pool = malloc(sz, M_PMT, M_WAITOK | M_ZERO);
+    if (!pool)
+        return ENOMEM;
+
+    pool->runv = malloc(sizeof(*pool->runv) * CPU_COUNT(cpuset), M_PMT, M_WAITOK);
+    if (!pool->runv) {
+        free(pool, M_PMT);
+        return ENOMEM;
+    }
+
+    pool->pmc = pmt_pmc;
+    pool->shroff = -1;
+
+    mtx_init(&pool->mtx, "pmtpool", (char *)0, MTX_DEF);
+    cv_init(&pool->cv, "pmtpool");
+    cv_init(&pool->donecv, "pmtdone");
+
+    rc = 0;
+
+    for (i = 0; i < MAXCPU; ++i) {
+        if (!CPU_ISSET(i, cpuset))
+            continue;
+
+        worker = &pool->workerv[pool->nworkers];
+        worker->pool = pool;
+        worker->vcpu = i;
+        worker->domain = pcpu_find(i)->pc_domain;
+
+        worker->priv = contigmalloc_domainset(PMT_PRIV_SIZE, M_PMT,
+                                              DOMAINSET_PREF(worker->domain),
+                                              M_WAITOK | M_ZERO,
+                                              0, ~(vm_paddr_t)0, PAGE_SIZE, 0);
+        if (!worker->priv) {
+            rc = ENOMEM;
+            break;
+        }
+
+        worker->priv_domain = pmt_addr_domain(worker->priv);
+
+        CPU_ZERO(&worker->vcpu_mask);
+        CPU_SET(i, &worker->vcpu_mask);
+        worker->selected = 1;
+        pool->runv[pool->nworkers] = worker;
+
+        rc = pmt_kthread_create(pmt_run_main, worker, "pmt");
+        if (rc) {
+            printf("%s: kthread create failed: %d\n", __func__, rc);
+            contigfree(worker->priv, PMT_PRIV_SIZE, M_PMT);
+            worker->priv = NULL;
+            break;
+        }
+
+        ++pool->nworkers;
+    }
+
+    pool->nrun = pool->nworkers;
+    pool->barrier.count = pool->nworkers;
+    pool->barrier.nworkers = pool->nworkers;
+
+    /* Wait for all the workers to affine themselves and park.
+     */
+    mtx_lock(&pool->mtx);
+    while (pool->nready < pool->nworkers)
+        cv_wait(&pool->donecv, &pool->mtx);
+    mtx_unlock(&pool->mtx);
+
+    for (i = 0; i < pool->nworkers && !rc; ++i)
+        rc = pool->workerv[i].rc;
+
+    if (rc) {
+        pmt_pool_destroy(pool);
+        return rc;
+    }
+
+    *poolp = pool;
+
+    return 0;
+}
+
+
+/* Tell all the workers to exit and wait for them to do so.
+ */
+static void
+pmt_pool_destroy(pmt_pool_t *pool)
+{
+    int i;
+
+    mtx_lock(&pool->mtx);
+    pool->exiting = 1;
+    cv_broadcast(&pool->cv);
+
+    while (pool->nexited < pool->nworkers)
+        cv_wait(&pool->donecv, &pool->mtx);
+    mtx_unlock(&pool->mtx);
+
+    for (i = 0; i < pool->nworkers; ++i)
+        contigfree(pool->workerv[i].priv, PMT_PRIV_SIZE, M_PMT);
+
+    cv_destroy(&pool->donecv);
+    cv_destroy(&pool->cv);
+    mtx_destroy(&pool->mtx);
+
+    free(pool->runv, M_PMT);
+    free(pool, M_PMT);
+}
+
+/* Select the workers on the vCPUs in the given set to run the samples
+ * of subsequent pmt_run() calls, the other workers sitting them out,
+ * as if the pool had been created for just that set.
+ */
+static void
+pmt_pool_select(pmt_pool_t *pool, const cpuset_t *set)
+{
+    int i;
+
+    mtx_lock(&pool->mtx);
+    pool->nrun = 0;
+
+    for (i = 0; i < pool->nworkers; ++i) {
+        pmt_worker_t *worker = &pool->workerv[i];
+
+        worker->selected = CPU_ISSET(worker->vcpu, set);
+        if (worker->selected)
+            pool->runv[pool->nrun++] = worker;
+
+        /* Workers that sat out samples have missed barrier flips.
+         */
+        worker->sense = pool->barrier.sense;
+    }
+
+    pool->barrier.count = pool->nrun;
+    pool->barrier.nworkers = pool->nrun;
+    mtx_unlock(&pool->mtx);
+}
+
+
 /* This function orchestrates running the give test concurrently
- * across all the vCPUs specified by pmt_cpuset.
+ * across all the vCPUs in the worker pool.
  */
 static int
-pmt_run(pmt_test_t *ptest, void *mem, size_t memsz, int samplesc, pmt_sample_t *samplesv)
+pmt_run(pmt_test_t *ptest, pmt_pool_t *pool, void *mem, size_t memsz,
+        int first, int last, u_long iters, pmt_sample_t *samplesv)
 {
     uint64_t samples_step = pmt_samples_step;
     int signaled = 0;
-    int rc;
     int n;
 
-    if (pmt_verbosity > 0) {
-        printf("\n%s:\n", ptest->name);
-
-        printf("%4s %16s %12s %12s %12s %8s %12s %9s\n",
-               "LOOP", "vCPUMASK", "CALLS", "CALLS/s",
-               "ns", "ns/CALL", "CYCLES", "CY/CALL");
-    }
-
-    for (n = 0; n < samplesc; ++n, ++samplesv) {
-        unsigned long cycles = 0;
-        unsigned long nsecs = 0;
-        unsigned int iters = 0;
-        int nworkers = 0;
+    for (n = first, samplesv += first; n < last; ++n, ++samplesv) {
+        uint64_t start_min, start_max, stop_min, stop_max;
         pmt_share_t *shr;
         int i;
 
-        shr = (pmt_share_t *)((uintptr_t)mem + (n * samples_step));
+        if (pool->shroff >= 0)
+            shr = (pmt_share_t *)((uintptr_t)mem + pool->shroff);
+        else
+            shr = (pmt_share_t *)((uintptr_t)mem + (n * samples_step));
 
-        if ((char *)shr > (char *)mem + memsz) {
+        if ((char *)(shr + 1) > (pool->wsbase ? (char *)pool->wsbase : (char *)mem + memsz)) {
             printf("%s: pmt_samples or pmt_samples_step changed...\n", __func__);
             return EINVAL;
         }
 
         memset(shr, 0, sizeof(*shr));
 
+        samplesv->domain = pmt_addr_domain(shr);
+
         mtx_init(&shr->mtx, "pmtmtx", (char *)0, MTX_DEF);
         mtx_init(&shr->spin, "pmtspin", (char *)0, MTX_SPIN);
         rw_init(&shr->rw, "pmtrw");
         sx_init(&shr->sx, "pmtsx");
         rm_init(&shr->rm, "pmtrm");
-        cv_init(&shr->cv, "pmtcv");
+        pmt_lockfree_init(shr);
+        pmt_spinlock_init(shr);
 
-        /* Start a worker thread for each vCPU in the set.
+        /* Prepare each worker's private data for this sample.
          */
-        for (i = 0; i < MAXCPU; ++i) {
-            if (CPU_ISSET(i, &pmt_cpuset)) {
-                pmt_priv_t *priv = &shr->priv[i];
-
-                priv->shr = shr;
-                priv->before = ptest->before;
-                priv->after = ptest->after;
-                priv->every = ptest->every;
-                priv->vcpu = i;
-
-                CPU_ZERO(&priv->vcpu_mask);
-                CPU_SET(i, &priv->vcpu_mask);
-
-                rc = pmt_kthread_create(pmt_run_main, priv, "pmt");
-                if (rc) {
-                    printf("%s: kthread create failed: %d\n", __func__, rc);
-                    continue;
-                }
+        for (i = 0; i < pool->nrun; ++i) {
+            pmt_worker_t *worker = pool->runv[i];
+            pmt_priv_t *priv = worker->priv;
+            pmt_test_t *wtest = ptest;
+
+            /* In the roles test each worker runs the test of its role.
+             */
+            if (ptest->roles && worker->test)
+                wtest = worker->test;
+
+            memset(priv, 0, sizeof(*priv));
+            priv->shr = shr;
+            priv->before = wtest->before;
+            priv->after = wtest->after;
+            priv->every = wtest->every;
+            priv->loop = wtest->loop;
+            priv->vcpu = worker->vcpu;
+            priv->worker = i;
+            priv->nworkers = pool->nrun;
+            priv->halt = &pool->stop;
+            priv->write_ppm = wtest->write_ppm;
+            priv->rng = 0x9e3779b97f4a7c15ul * (i + 1);
+            priv->clh = &priv->clh_node;
+            priv->spin_budget = pmt_spin_budget;
+            priv->handoff_wait = pmt_muldiv(PMT_HANDOFF_WAIT, tsc_freq, 1000000000ul);
+
+            priv->cs_spins = pmt_work_spins(wtest->cs_cycles);
+            priv->think_spins = pmt_work_spins(wtest->think_cycles);
+            priv->cs_bytes = wtest->cs_bytes;
+            priv->think_bytes = wtest->think_bytes;
+            priv->think_buf = (u_char *)priv + PMT_PRIV_THINK;
+
+            /* Pair up the workers for the SPSC test, each even worker
+             * pushing to the ring of the following odd worker.
+             */
+            priv->ring = priv;
+            if (i & 1) {
+                priv->spsc = PMT_SPSC_CONSUMER;
+            } else if (i + 1 < pool->nrun) {
+                priv->spsc = PMT_SPSC_PRODUCER;
+                priv->ring = pool->runv[i + 1]->priv;
+            }
 
-                iters += pmt_iters;
-                ++nworkers;
+            /* Spread the workers' starting points around the chase.
+             */
+            if (ptest->wss > 0) {
+                size_t nlines = ptest->wss / CACHE_LINE_SIZE;
+
+                priv->chase = (void **)((char *)pool->wsbase +
+                                        (i * nlines / pool->nrun) * CACHE_LINE_SIZE);
             }
-        }
 
-        /* Wait/poll for all worker threads to get to the cv_wait rendezvous point
-         * (i.e., all workers threads have been created and are waiting on &shr->cv).
-         */
-        mtx_lock(&shr->mtx);
-        while (shr->nwaiting < nworkers) {
-            msleep(shr, &shr->mtx, 0, "wait", hz / 10);
+            /* Give each worker its own slice for the stream arrays.
+             */
+            if (ptest->bytes > 0) {
+                priv->wss = pmt_stream_slice();
+                priv->wsbase = (char *)pool->wsbase + i * priv->wss;
+            }
+
+            /* Space the workers' stride counters ptest->stride apart.
+             */
+            if (ptest->stride > 0) {
+                priv->wss = ptest->stride;
+                priv->wsbase = (char *)pool->wsbase + i * ptest->stride;
+                *(u_long *)priv->wsbase = 0;
+            }
         }
 
-        /* Give all worker threads ~33ms to wake up and reach the busy-wait
-         * rendezvous point (in an attempt to arrange that they are all scheduled
-         * and running and hence start the test at approximately the same time).
+        mtx_lock(&pool->mtx);
+        pool->shr = shr;
+        pool->iters = iters;
+        pool->stop = 0;
+        pool->ndone = 0;
+
+        /* Signal all the worker threads to start running (they rendezvous
+         * at the pool barrier so as to all start at the same time), then
+         * wait for them all to finish.  The last thread to finish will wake
+         * us up.
          */
-#ifdef PMT_TSC
-        shr->sync = rdtsc() + tsc_freq / 33;
-#else
-        shr->sync = getnanotime() + 33 * 1000000;
-#endif
+        ++pool->gen;
+        cv_broadcast(&pool->cv);
 
-        /* Signal all the worker threads to start running, then wait for
-         * them all to finish.  The last thread to finish will wake us up.
+        /* If the workers are to run until stopped then wait out
+         * the sample duration and then tell them to stop.
          */
-        cv_broadcast(&shr->cv);
+        if (iters == 0) {
+            uint64_t end = pmt_now() + pmt_nsecs2delta(pmt_duration * 1000000ul);
+            uint64_t now;
+
+            while (!signaled && (now = pmt_now()) < end) {
+                int timo = pmt_muldiv(pmt_delta2nsecs(end - now), hz, 1000000000ul) + 1;
+                int rc;
+
+                rc = cv_timedwait_sig(&pool->donecv, &pool->mtx, timo);
+                if (rc && rc != EWOULDBLOCK)
+                    signaled = rc;
+            }
 
-        signaled = cv_wait_sig(&shr->cv, &shr->mtx);
-        if (signaled) {
-            cv_wait(&shr->cv, &shr->mtx);
+            atomic_store_rel_int(&pool->stop, 1);
         }
-        mtx_unlock(&shr->mtx);
 
+        while (pool->ndone < pool->nrun && !signaled)
+            signaled = cv_wait_sig(&pool->donecv, &pool->mtx);
 
-        /* Test is done, record results then clean up.
+        while (pool->ndone < pool->nrun)
+            cv_wait(&pool->donecv, &pool->mtx);
+
+        pool->shr = NULL;
+        mtx_unlock(&pool->mtx);
+
+
+        /* Test is done, record results then clean up.  The sample time
+         * runs from the first worker to start to the last worker to stop.
          */
-        samplesv->delta = shr->stop - shr->start;
-        samplesv->iters = iters;
+        start_min = stop_min = UINT64_MAX;
+        start_max = stop_max = 0;
 
-#ifdef PMT_TSC
-        cycles = (shr->stop - shr->start);
-        nsecs = pmt_cycles2nsecs(cycles);
-#else
-        nsecs = samplesv->delta;
-#endif
+        for (i = 0; i < pool->nrun; ++i) {
+            pmt_priv_t *priv = pool->runv[i]->priv;
 
-        if (nsecs == 0) {
-            nsecs = 1;
-        }
-        if (iters == 0) {
-            iters = 1;
+            samplesv->workerv[i].delta = priv->stop - priv->start;
+            samplesv->workerv[i].iters = priv->iters;
+            memcpy(samplesv->workerv[i].pmcv, pool->runv[i]->pmcv,
+                   sizeof(samplesv->workerv[i].pmcv));
+
+            start_min = MIN(start_min, priv->start);
+            start_max = MAX(start_max, priv->start);
+            stop_min = MIN(stop_min, priv->stop);
+            stop_max = MAX(stop_max, priv->stop);
         }
 
-        if (pmt_verbosity > 0) {
-            printf("%4d %016lx %12u %12lu %12lu %8lu %12lu %9lu\n",
-                   n, pmt_cpuset.__bits[0],
-                   iters,                                   // CALLS
-                   (iters * 1000000000ul) / nsecs,          // CALLS/s
-                   nsecs,                                   // ns
-                   nsecs / iters,                           // ns/CALL
-                   cycles,                                  // CYCLES
-                   cycles / iters);                         // CY/CALL
+        samplesv->delta = stop_max - start_min;
+        samplesv->iters = 0;
+        samplesv->handoffs = samplesv->handoff_cycles = 0;
+        samplesv->handoff_nosleep = 0;
+        samplesv->reads = samplesv->writes = 0;
+        samplesv->read_cycles = samplesv->write_cycles = 0;
+
+        for (i = 0; i < pool->nrun; ++i) {
+            pmt_priv_t *priv = pool->runv[i]->priv;
+
+            samplesv->iters += samplesv->workerv[i].iters;
+            samplesv->handoffs += priv->handoffs;
+            samplesv->handoff_cycles += priv->handoff_cycles;
+            samplesv->handoff_nosleep += priv->handoff_nosleep;
+            samplesv->reads += priv->reads;
+            samplesv->writes += priv->writes;
+            samplesv->read_cycles += priv->read_cycles;
+            samplesv->write_cycles += priv->write_cycles;
         }
+        samplesv->start_skew = start_max - start_min;
+        samplesv->stop_skew = stop_max - stop_min;
+        samplesv->rejected = (pmt_skew_max > 0 &&
+                              samplesv->start_skew * 100 >
+                              samplesv->delta * pmt_skew_max);
 
-        cv_destroy(&shr->cv);
         rm_destroy(&shr->rm);
         rw_destroy(&shr->rw);
         sx_destroy(&shr->sx);
@@ -700,6 +4335,7 @@ pmt_run(pmt_test_t *ptest, void *mem, size_t memsz, int samplesc, pmt_sample_t *
 }
 
 
+#ifdef _KERNEL
 static int
 pmt_kthread_create(void (*func)(void *), void *arg, const char *name)
 {
@@ -719,6 +4355,75 @@ pmt_kthread_create(void (*func)(void *), void *arg, const char *name)
 
     return 0;
 }
+#else
+
+typedef struct {
+    void  (*func)(void *);
+    void   *arg;
+} pmt_kthread_args_t;
+
+static void *
+pmt_kthread_main(void *arg)
+{
+    pmt_kthread_args_t args = *(pmt_kthread_args_t *)arg;
+
+    free(arg, M_PMT);
+    args.func(args.arg);
+
+    return NULL;
+}
+
+/* Create a detached pthread to stand in for a kthread.  If pmt_pri is
+ * non-zero the thread runs SCHED_FIFO at that priority, falling back
+ * to SCHED_OTHER if we lack the privilege to do so.
+ */
+static int
+pmt_kthread_create(void (*func)(void *), void *arg, const char *name)
+{
+    pmt_kthread_args_t *args;
+    struct sched_param param;
+    pthread_attr_t attr;
+    pthread_t td;
+    int rc;
+
+    args = malloc(sizeof(*args), M_PMT, M_WAITOK);
+    if (!args)
+        return ENOMEM;
+
+    args->func = func;
+    args->arg = arg;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    if (pmt_pri > 0) {
+        param.sched_priority = pmt_pri;
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+
+    rc = pthread_create(&td, &attr, pmt_kthread_main, args);
+    if (rc == EPERM && pmt_pri > 0) {
+        printf("%s: unable to use SCHED_FIFO, using SCHED_OTHER\n", __func__);
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        rc = pthread_create(&td, &attr, pmt_kthread_main, args);
+    }
+
+    pthread_attr_destroy(&attr);
+
+    if (rc) {
+        printf("%s: pthread_create: rc=%d\n", __func__, rc);
+        free(args, M_PMT);
+        return rc;
+    }
+
+    pthread_setname_np(td, name);
+
+    return 0;
+}
+#endif
+
 
 
 
@@ -726,6 +4431,7 @@ static int
 pmt_modevent(module_t mod, int cmd, void *data)
 {
     int rc = 0;
+    int i;
 
     switch (cmd) {
     case MOD_LOAD:
@@ -741,6 +4447,11 @@ pmt_modevent(module_t mod, int cmd, void *data)
         break;
 
     case MOD_UNLOAD:
+        for (i = 0; i < PMT_BASELINES_MAX; ++i)
+            pmt_bl_clear(&pmt_blv[i]);
+        pmt_bl_clear(&pmt_bl_last);
+        free(pmt_results, M_PMT);
+        pmt_results = NULL;
         break;
 
     default:
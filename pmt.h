@@ -11,21 +11,99 @@ struct pmt_priv_s;
 struct pmt_share_s;
 
 typedef int pmt_test_cb_t(struct pmt_share_s *shr, struct pmt_priv_s *priv);
+typedef u_long pmt_test_loop_t(struct pmt_share_s *shr, struct pmt_priv_s *priv,
+                               u_long iters, volatile u_int *stop);
 
+#define PMT_MPMC_SIZE   (1024)  // Number of slots in the MPMC ring (power of 2)
+#define PMT_SPSC_SIZE   (64)    // Number of slots in each SPSC ring (power of 2)
+#define PMT_STACK_SIZE  (1024)  // Number of nodes in the Treiber stack
+#define PMT_STACK_NIL   (0xfffffffful)     // Index of no node
+#define PMT_STACK_TAG   (0x100000000ul)    // Increment of the stack top ABA tag
 
-/* Per-worker thread private data (and hence per-cpu).
+#define PMT_WORK_MAX    (4096)  // Max bytes touched per call by a lock test's work
+
+#define PMT_EREGRESS    (EDOM)  // Error of a run that found regressions
+
+#define PMT_SPSC_SOLO       (0) // Push to and pop from its own ring
+#define PMT_SPSC_PRODUCER   (1) // Push to the next worker's ring
+#define PMT_SPSC_CONSUMER   (2) // Pop from its own ring
+
+typedef struct {
+    volatile u_long seq;        // Ring position at which the slot is next ready
+    u_long          val;
+} pmt_mpmc_slot_t;
+
+/* Queue node of the MCS, CLH and queued spinlocks.
+ */
+typedef struct {
+    volatile u_long next;       // MCS successor node (a pmt_qnode_t pointer)
+    volatile u_int  locked;     // Set while waiting (MCS) or waiting/holding (CLH)
+} __aligned(CACHE_LINE_SIZE) pmt_qnode_t;
+
+
+/* Per-worker thread private data (and hence per-cpu), each allocated
+ * separately on its worker's NUMA domain.
  */
 typedef struct pmt_priv_s {
     struct pmt_share_s *shr;
-    cpuset_t vcpu_mask;
     int vcpu;
+    int worker;                 // Index of this worker in the pool
+    int nworkers;               // Number of workers in the pool
 
     pmt_test_cb_t *before;      // Func to call just once before every()
     pmt_test_cb_t *every;       // Func to call on every iteration
     pmt_test_cb_t *after;       // Func to call just once after every()
+    pmt_test_loop_t *loop;      // Specialized loop to run instead of every()
 
     u_long count;
-} pmt_priv_t;
+    void **chase;               // Current position in the pointer chase
+    void *wsbase;               // This worker's stream arrays or stride counter
+    size_t wss;                 // Size of the slice (bytes)
+    size_t pos;                 // Current position in the slice (elements)
+
+    u_long   iters;             // Number of iterations run by this worker
+    uint64_t start;             // Start time in cycles or nanoseconds
+    uint64_t stop;              // Stop time in cycles or nanoseconds
+
+    uint64_t rng;               // State of this worker's xorshift PRNG
+    u_int    write_ppm;         // Write fraction of a mixed test (per million)
+    u_long   reads;             // Mixed test calls that took the read lock
+    u_long   writes;            // Mixed test calls that took the write lock
+    uint64_t read_cycles;       // TSC cycles spent in those reads
+    uint64_t write_cycles;      // TSC cycles spent in those writes
+
+    volatile u_int *halt;       // Set when a timed sample is to stop
+    struct pmt_priv_s *ring;    // Private data holding our SPSC ring
+    int spsc;                   // PMT_SPSC_SOLO, _PRODUCER or _CONSUMER
+
+    __aligned(CACHE_LINE_SIZE)
+    volatile u_long spsc_head;  // Next SPSC ring slot to pop
+    u_long spsc_tail_cache;     // Consumer's copy of spsc_tail
+
+    __aligned(CACHE_LINE_SIZE)
+    volatile u_long spsc_tail;  // Next SPSC ring slot to push
+    u_long spsc_head_cache;     // Producer's copy of spsc_head
+
+    __aligned(CACHE_LINE_SIZE)
+    u_long spsc_ringv[PMT_SPSC_SIZE];
+
+    u_int    spin_budget;       // Spins on a held adaptive lock before parking
+    u_long   handoffs;          // Handoffs measured by this worker
+    uint64_t handoff_cycles;    // TSC cycles from release to acquire of those
+    u_long   handoff_nosleep;   // Handoffs not measured since we never slept
+    uint64_t handoff_wait;      // TSC cycles to let the handoff waiter go to sleep
+
+    pmt_qnode_t mcs_node;       // This worker's MCS (and queued spinlock) node
+    pmt_qnode_t clh_node;       // CLH node with which this worker starts
+    pmt_qnode_t *clh;           // CLH node this worker enqueues next
+    pmt_qnode_t *clh_pred;      // CLH node of our predecessor (while held)
+
+    u_int    cs_spins;          // Pause loops per call while holding the lock
+    u_int    cs_bytes;          // Bytes of cs_buf touched per call while holding the lock
+    u_int    think_spins;       // Pause loops per call between acquisitions
+    u_int    think_bytes;       // Bytes of think_buf touched per call between acquisitions
+    volatile u_char *think_buf; // PMT_WORK_MAX bytes of private data (follows the priv)
+} __aligned(CACHE_LINE_SIZE) pmt_priv_t;
 
 
 /* Data shared amongst all test worker threads.
@@ -54,15 +132,63 @@ typedef struct pmt_share_s {
     u_long        rm_count;
 
     __aligned(64)
-    struct cv   cv;         // Used for worker thread synchronization
-    uint64_t    stop;       // Stop time in cycles or nanoseconds
-    uint64_t    start;      // Start time in cycles or nanoseconds
-    uint64_t    sync;       // Used to synchronize test worker threads
-    u_int       nwaiting;   // Number of workers waiting to start a test
-    u_int       nrunning;   // Number of worker threads running a test
+    volatile u_long pingpong;   // Bounced between workers 0 and 1
+
+    __aligned(64)
+    volatile u_long mpmc_head;  // Next MPMC ring position to dequeue
+
+    __aligned(64)
+    volatile u_long mpmc_tail;  // Next MPMC ring position to enqueue
+
+    __aligned(64)
+    pmt_mpmc_slot_t mpmcv[PMT_MPMC_SIZE];
+
+    __aligned(64)
+    volatile u_long stack_top;  // ABA tag (upper 32 bits) and top node index
+
+    __aligned(64)
+    volatile u_int stack_nextv[PMT_STACK_SIZE];
+
+    __aligned(64)
+    volatile u_int  tas;        // Test-and-set spinlock
+    u_long          tas_count;
+
+    __aligned(64)
+    volatile u_int  ttas;       // Test-and-test-and-set spinlock
+    u_long          ttas_count;
+
+    __aligned(64)
+    volatile u_int  ticket_next;    // Next ticket to hand out
+    volatile u_int  ticket_owner;   // Ticket now being served
+    u_long          ticket_count;
+
+    __aligned(64)
+    volatile u_long mcs_tail;   // Last MCS node in the queue (or 0)
+    u_long          mcs_count;
+
+    __aligned(64)
+    volatile u_long clh_tail;   // Last CLH node in the queue
+    u_long          clh_count;
+
+    pmt_qnode_t     clh_dummy;  // Initial CLH tail node
+
+    __aligned(64)
+    volatile u_int  qspin;      // Queued spinlock lock word
+    volatile u_long qspin_tail; // Last MCS node waiting for the lock word
+    u_long          qspin_count;
+
+    __aligned(64)
+    volatile u_int  adaptive;   // Adaptive lock (0 free, 1 held, 2 held with waiters)
+    u_long          adaptive_count;
+
+    __aligned(64)
+    volatile u_int  handoff;    // Adaptive lock handed from worker 0 to 1
+    volatile u_long handoff_seq;    // Odd while worker 0 holds the lock for worker 1
+    volatile uint64_t handoff_stamp; // TSC at which worker 0 released the lock
+    volatile u_long handoff_parking; // handoff_seq once worker 1 is about to park
 
     __aligned(64)
-    pmt_priv_t priv[MAXCPU];// Array of per-worker thread private data
+    volatile u_char cs_buf[PMT_WORK_MAX];   // Data touched in the critical section
 } pmt_share_t;
 
 #endif /* PMT_H */
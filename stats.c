@@ -0,0 +1,442 @@
+/*
+ * Copyright (c) 2013,2016-2017 Greg Becker.  All rights reserved.
+ *
+ * Performance test module.
+ *
+ * Sample statistics.  Everything here is done in integer arithmetic
+ * so that it can run in the kernel.
+ */
+
+#ifdef _KERNEL
+#include <sys/param.h>
+#include <sys/limits.h>
+#include <sys/systm.h>
+#else
+#include "compat.h"
+#endif
+
+#include "stats.h"
+
+
+/* Two-sided 95% critical values of Student's t distribution (x1000)
+ * indexed by degrees of freedom.
+ */
+static const u_int pmt_t95[] = {
+    0, 12706, 4303, 3182, 2776, 2571, 2447, 2365, 2306, 2262, 2228,
+    2201, 2179, 2160, 2145, 2131, 2120, 2110, 2101, 2093, 2086,
+    2080, 2074, 2069, 2064, 2060, 2056, 2052, 2048, 2045, 2042,
+};
+
+static u_int
+pmt_t95_x1000(int df)
+{
+    if (df < 1)
+        return 0;
+
+    if (df < sizeof(pmt_t95) / sizeof(pmt_t95[0]))
+        return pmt_t95[df];
+
+    if (df < 60)
+        return 2021;
+
+    if (df < 120)
+        return 2000;
+
+    return 1980;
+}
+
+
+/* Integer square root.
+ */
+uint64_t
+pmt_isqrt(uint64_t x)
+{
+    uint64_t root, bit;
+
+    root = 0;
+    bit = 1ull << 62;
+
+    while (bit > x)
+        bit >>= 2;
+
+    while (bit) {
+        if (x >= root + bit) {
+            x -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return root;
+}
+
+/* Compute (x * y) / z using a 128-bit intermediate product so that it
+ * cannot overflow, saturating if the quotient doesn't fit in 64 bits.
+ * The division is done longhand as 128-bit division isn't available
+ * in the kernel.
+ */
+u_long
+pmt_muldiv(u_long x, u_long y, u_long z)
+{
+    unsigned __int128 prod = (unsigned __int128)x * y;
+    uint64_t hi = prod >> 64;
+    uint64_t lo = prod;
+    uint64_t quo = 0;
+    int i;
+
+    if (z == 0)
+        z = 1;
+
+    if (hi == 0)
+        return lo / z;
+
+    if (hi >= z)
+        return UINT64_MAX;
+
+    for (i = 0; i < 64; ++i) {
+        int carry = hi >> 63;
+
+        hi = (hi << 1) | (lo >> 63);
+        lo <<= 1;
+        quo <<= 1;
+
+        if (carry || hi >= z) {
+            hi -= z;
+            quo |= 1;
+        }
+    }
+
+    return quo;
+}
+
+static void
+pmt_sort(uint64_t *valv, int valc)
+{
+    int i, j;
+
+    for (i = 1; i < valc; ++i) {
+        uint64_t val = valv[i];
+
+        for (j = i; j > 0 && valv[j - 1] > val; --j)
+            valv[j] = valv[j - 1];
+
+        valv[j] = val;
+    }
+}
+
+static uint64_t
+pmt_median(const uint64_t *sortedv, int valc)
+{
+    if (valc < 1)
+        return 0;
+
+    if (valc % 2)
+        return sortedv[valc / 2];
+
+    return (sortedv[valc / 2 - 1] + sortedv[valc / 2]) / 2;
+}
+
+static uint64_t
+pmt_absdiff(uint64_t x, uint64_t y)
+{
+    return (x > y) ? x - y : y - x;
+}
+
+
+/* Compute the summary statistics of the first valc values of valv.
+ *
+ * If mad_k10 is not zero then values that lie more than mad_k10/10
+ * scaled median absolute deviations from the median are rejected as
+ * outliers (and flagged in outlierv[], if given) prior to computing
+ * the statistics.  Values beyond PMT_STATS_MAX are ignored.
+ */
+void
+pmt_stats_compute(const uint64_t *valv, int valc, u_int mad_k10,
+                  char *outlierv, pmt_stats_t *stats)
+{
+    uint64_t sortedv[PMT_STATS_MAX];
+    uint64_t median, mad, limit;
+    uint64_t sum, var;
+    int i, n;
+
+    memset(stats, 0, sizeof(*stats));
+
+    valc = MIN(valc, PMT_STATS_MAX);
+    if (valc < 1)
+        return;
+
+    for (i = 0; i < valc; ++i)
+        sortedv[i] = valv[i];
+
+    pmt_sort(sortedv, valc);
+    median = pmt_median(sortedv, valc);
+
+    /* The MAD is scaled by 1.4826 so as to estimate the standard
+     * deviation of normally distributed data.
+     */
+    limit = UINT64_MAX;
+
+    if (mad_k10 > 0) {
+        for (i = 0; i < valc; ++i)
+            sortedv[i] = pmt_absdiff(valv[i], median);
+
+        pmt_sort(sortedv, valc);
+        mad = pmt_median(sortedv, valc);
+
+        if (mad > 0)
+            limit = (mad * 14826 / 10000) * mad_k10 / 10;
+    }
+
+    for (n = i = 0; i < valc; ++i) {
+        int outlier = (pmt_absdiff(valv[i], median) > limit);
+
+        if (outlierv)
+            outlierv[i] = outlier;
+
+        if (!outlier)
+            sortedv[n++] = valv[i];
+    }
+
+    /* With very few values (e.g., two) all of them can lie beyond the
+     * limit, in which case none are rejected.
+     */
+    if (n < 1) {
+        for (n = 0; n < valc; ++n) {
+            if (outlierv)
+                outlierv[n] = 0;
+            sortedv[n] = valv[n];
+        }
+    }
+
+    stats->noutliers = valc - n;
+    stats->n = n;
+
+    pmt_sort(sortedv, n);
+
+    sum = 0;
+    for (i = 0; i < n; ++i)
+        sum += sortedv[i];
+
+    stats->min = sortedv[0];
+    stats->max = sortedv[n - 1];
+    stats->median = pmt_median(sortedv, n);
+    stats->mean = sum / n;
+    stats->p90 = sortedv[(n * 9 + 9) / 10 - 1];
+
+    if (n < 2)
+        return;
+
+    var = 0;
+    for (i = 0; i < n; ++i) {
+        uint64_t dev = pmt_absdiff(sortedv[i], stats->mean);
+
+        var += dev * dev;
+    }
+
+    stats->stddev = pmt_isqrt(var / (n - 1));
+    stats->ci = (pmt_t95_x1000(n - 1) * stats->stddev) / pmt_isqrt(n * 1000000ul);
+}
+
+
+/* Compute (x * y) / z for a signed x.
+ */
+static int64_t
+pmt_smuldiv(int64_t x, uint64_t y, uint64_t z)
+{
+    if (x < 0)
+        return -(int64_t)pmt_muldiv(-x, y, z);
+
+    return pmt_muldiv(x, y, z);
+}
+
+/* Return the USL denominator 1 + sigma(n - 1) + kappa n(n - 1) (ppm) at
+ * n / 1000 threads, clamped at 1 ppm.
+ */
+static int64_t
+pmt_usl_denom(const pmt_usl_t *usl, uint64_t n1k)
+{
+    int64_t x1k = n1k - 1000;
+    int64_t denom;
+
+    denom = 1000000 + usl->sigma * x1k / 1000
+        + pmt_smuldiv(usl->kappa * x1k, n1k, 1000000);
+
+    return MAX(denom, 1);
+}
+
+/* Return the throughput predicted by the given USL fit at n threads.
+ */
+uint64_t
+pmt_usl_predict(const pmt_usl_t *usl, u_int n)
+{
+    return pmt_muldiv(usl->lambda, n * 1000000ul, pmt_usl_denom(usl, n * 1000ul));
+}
+
+/* Fit the Universal Scalability Law
+ *
+ *     X(n) = lambda n / (1 + sigma (n - 1) + kappa n (n - 1))
+ *
+ * to the throughputs ratev[] measured at the thread counts nv[], where
+ * nv[0] must be 1 (lambda is taken to be ratev[0]).  With x = n - 1 and
+ * y = n X(1) / X(n) - 1 the law becomes y = kappa x^2 + (sigma + kappa) x,
+ * which is fit by least squares.  At least two thread counts greater
+ * than one are required, otherwise usl->n is set to zero.
+ */
+void
+pmt_usl_fit(const u_int *nv, const uint64_t *ratev, int c, pmt_usl_t *usl)
+{
+    int64_t sx2, sx3, sx4, sxy, sx2y;
+    int64_t a, b, d;
+    uint64_t ssres, sstot, mean;
+    int i, m;
+
+    memset(usl, 0, sizeof(*usl));
+
+    if (c < 3 || nv[0] != 1 || ratev[0] == 0)
+        return;
+
+    usl->lambda = ratev[0];
+
+    sx2 = sx3 = sx4 = sxy = sx2y = 0;
+
+    for (m = 0, i = 1; i < c; ++i) {
+        int64_t x = nv[i] - 1;
+        int64_t y;
+
+        if (ratev[i] == 0 || x < 1)
+            continue;
+
+        y = pmt_muldiv(nv[i] * ratev[0], 1000000, ratev[i]);
+        y = MIN(y, 1000000000000l) - 1000000;
+
+        sx2 += x * x;
+        sx3 += x * x * x;
+        sx4 += x * x * x * x;
+        sxy += x * y;
+        sx2y += x * x * y;
+        ++m;
+    }
+
+    d = sx4 * sx2 - sx3 * sx3;
+    if (m < 2 || d < 1)
+        return;
+
+    a = pmt_smuldiv(sx2y, sx2, d) - pmt_smuldiv(sxy, sx3, d);
+    b = pmt_smuldiv(sxy, sx4, d) - pmt_smuldiv(sx2y, sx3, d);
+
+    usl->n = m + 1;
+    usl->kappa = a;
+    usl->sigma = b - a;
+
+    /* Goodness of fit of the relative capacity X(n) / X(1) (x10000).
+     */
+    mean = 0;
+    for (i = 0; i < c; ++i)
+        mean += pmt_muldiv(ratev[i], 10000, ratev[0]);
+    mean /= c;
+
+    ssres = sstot = 0;
+    for (i = 0; i < c; ++i) {
+        int64_t cap = pmt_muldiv(ratev[i], 10000, ratev[0]);
+        int64_t fit = pmt_muldiv(pmt_usl_predict(usl, nv[i]), 10000, ratev[0]);
+
+        ssres += (cap - fit) * (cap - fit);
+        sstot += (cap - (int64_t)mean) * (cap - (int64_t)mean);
+    }
+
+    if (sstot > 0)
+        usl->r2 = 1000 - (int64_t)pmt_muldiv(ssres, 1000, sstot);
+    else
+        usl->r2 = (ssres > 0) ? 0 : 1000;
+
+    /* Throughput peaks at sqrt((1 - sigma) / kappa) threads if there is
+     * any coherency cost, otherwise it approaches lambda / sigma.
+     */
+    if (usl->kappa > 0 && usl->sigma < 1000000) {
+        usl->peak_n = pmt_isqrt(pmt_muldiv(1000000 - usl->sigma, 1000000, usl->kappa));
+        usl->peak_x = pmt_muldiv(usl->lambda, usl->peak_n * 1000,
+                                 pmt_usl_denom(usl, usl->peak_n));
+    } else if (usl->kappa <= 0 && usl->sigma > 0) {
+        usl->peak_x = pmt_muldiv(usl->lambda, 1000000, usl->sigma);
+    }
+}
+
+
+/* Two-sided tail probabilities of the standard normal distribution
+ * (x10000) at z = 0.0, 0.1, ... 4.0.
+ */
+static const u_short pmt_norm2p[] = {
+    10000, 9203, 8415, 7642, 6892, 6171, 5485, 4839, 4237, 3681,
+    3173, 2713, 2301, 1936, 1615, 1336, 1096, 891, 719, 574,
+    455, 357, 278, 214, 164, 124, 93, 69, 51, 37,
+    27, 19, 14, 10, 7, 5, 3, 2, 1, 1,
+    1,
+};
+
+/* Compare two sets of values with the Mann-Whitney U test, using the
+ * normal approximation with continuity and tie corrections.  Returns
+ * the two-sided p-value (x10000) of the hypothesis that neither set
+ * tends to be larger than the other, and stores |z| (x100) in *z100p.
+ */
+u_int
+pmt_mann_whitney(const uint64_t *xv, int xc, const uint64_t *yv, int yc, u_int *z100p)
+{
+    uint64_t u2, mn, dev, ties, n, denom;
+    u_int z100, i;
+    int j, k;
+
+    *z100p = 0;
+
+    if (xc < 1 || yc < 1)
+        return 10000;
+
+    /* Twice the U statistic of y (i.e., counting ties as 1 rather than 0.5).
+     */
+    u2 = 0;
+    for (j = 0; j < xc; ++j) {
+        for (k = 0; k < yc; ++k)
+            u2 += (yv[k] > xv[j]) ? 2 : (yv[k] == xv[j]);
+    }
+
+    /* The sum of t^3 - t over each group of t tied values, which is the
+     * sum of t^2 - 1 over each value.
+     */
+    ties = 0;
+    for (j = 0; j < xc + yc; ++j) {
+        uint64_t val = (j < xc) ? xv[j] : yv[j - xc];
+        uint64_t t = 0;
+
+        for (k = 0; k < xc; ++k)
+            t += (xv[k] == val);
+        for (k = 0; k < yc; ++k)
+            t += (yv[k] == val);
+
+        ties += t * t - 1;
+    }
+
+    mn = (uint64_t)xc * yc;
+    n = xc + yc;
+    dev = (u2 > mn) ? u2 - mn : mn - u2;
+
+    if (dev <= 1)
+        return 10000;
+
+    /* z = (|U - mn/2| - 1/2) / sqrt(var), where 12 n (n - 1) var is
+     * mn ((n + 1) n (n - 1) - ties).
+     */
+    denom = mn * ((n + 1) * n * (n - 1) - ties);
+    if (denom == 0)
+        return 10000;
+
+    dev = (dev - 1) * 50;
+    z100 = pmt_isqrt(pmt_muldiv(dev * dev, 12 * n * (n - 1), denom));
+    *z100p = z100;
+
+    i = z100 / 10;
+    if (i + 1 >= sizeof(pmt_norm2p) / sizeof(pmt_norm2p[0]))
+        return 0;
+
+    return pmt_norm2p[i] - (pmt_norm2p[i] - pmt_norm2p[i + 1]) * (z100 % 10) / 10;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2013,2016-2017 Greg Becker.  All rights reserved.
+ *
+ * Performance test module.
+ */
+
+#ifndef PMT_STATS_H
+#define PMT_STATS_H
+
+#define PMT_STATS_MAX   (128)   // Max number of values pmt_stats_compute() handles
+
+/* Summary statistics of a set of samples.  All statistics are in the
+ * same units as the sample values, and are computed only over the
+ * values not rejected as outliers.
+ */
+typedef struct {
+    int         n;              // Number of values used
+    int         noutliers;      // Number of values rejected as outliers
+    uint64_t    min;
+    uint64_t    max;
+    uint64_t    median;
+    uint64_t    mean;
+    uint64_t    stddev;         // Sample standard deviation
+    uint64_t    p90;            // 90th percentile
+    uint64_t    ci;             // Half-width of the 95% confidence interval of the mean
+} pmt_stats_t;
+
+/* A Universal Scalability Law fit of throughput vs thread count.
+ */
+typedef struct {
+    int         n;              // Number of thread counts fit (0 if no fit)
+    uint64_t    lambda;         // Throughput of one thread
+    int64_t     sigma;          // Contention (ppm)
+    int64_t     kappa;          // Coherency (ppm)
+    int64_t     r2;             // Coefficient of determination (x1000)
+    uint64_t    peak_n;         // Thread count of peak throughput (x1000, 0 if none)
+    uint64_t    peak_x;         // Peak (or asymptotic) throughput (0 if unbounded)
+} pmt_usl_t;
+
+u_long pmt_muldiv(u_long x, u_long y, u_long z);
+uint64_t pmt_isqrt(uint64_t x);
+
+void pmt_stats_compute(const uint64_t *valv, int valc, u_int mad_k10,
+                       char *outlierv, pmt_stats_t *stats);
+
+void pmt_usl_fit(const u_int *nv, const uint64_t *ratev, int c, pmt_usl_t *usl);
+uint64_t pmt_usl_predict(const pmt_usl_t *usl, u_int n);
+
+u_int pmt_mann_whitney(const uint64_t *xv, int xc, const uint64_t *yv, int yc,
+                       u_int *z100p);
+
+#endif /* PMT_STATS_H */
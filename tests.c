@@ -4,6 +4,7 @@
  * Performance test module.
  */
 
+#ifdef _KERNEL
 #include <sys/param.h>
 #include <sys/limits.h>
 #include <sys/systm.h>
@@ -25,6 +26,13 @@
 #include <sys/smp.h>
 #include <sys/cpuset.h>
 #include <sys/module.h>
+#include <sys/sleepqueue.h>
+#include <machine/atomic.h>
+#include <machine/cpu.h>
+#include <machine/cpufunc.h>
+#else
+#include "compat.h"
+#endif
 
 #include "pmt.h"
 #include "tests.h"
@@ -40,173 +48,421 @@ pmt_func_every(pmt_share_t *shr, pmt_priv_t *priv)
 }
 
 
-/* Increment a shared counter (no synchronization).
+/* Bounce a cache line between workers 0 and 1, each call making one
+ * round trip: The pinger stores the next odd value into the line and
+ * then waits for the other worker to answer with the following even
+ * value.  Any other workers sit out.  The waits deliberately don't
+ * pause so as to see each transfer as soon as possible.
+ *
+ * Both workers must make the same number of calls, so the results of
+ * timed samples are approximate, and the waits give up once a timed
+ * sample has been told to stop.
+ */
+static inline void
+pmt_pingpong(pmt_share_t *shr, pmt_priv_t *priv, int pinger)
+{
+    u_long seq = priv->count++ * 2;
+
+    if (priv->worker == pinger) {
+        shr->pingpong = seq + 1;
+        while (shr->pingpong != seq + 2 && !*priv->halt)
+            continue;
+    } else if (priv->worker == !pinger) {
+        while (shr->pingpong != seq + 1 && !*priv->halt)
+            continue;
+        shr->pingpong = seq + 2;
+    }
+}
+
+/* Ping-pong with worker 0 pinging.
  */
 int
-pmt_inc_shared_every(pmt_share_t *shr, pmt_priv_t *priv)
+pmt_pingpong_every(pmt_share_t *shr, pmt_priv_t *priv)
 {
-    ++shr->count;
+    pmt_pingpong(shr, priv, 0);
 
     return 0;
 }
 
+/* Ping-pong with worker 1 pinging.
+ */
+int
+pmt_pongping_every(pmt_share_t *shr, pmt_priv_t *priv)
+{
+    pmt_pingpong(shr, priv, 1);
+
+    return 0;
+}
+
+
+/* Follow the pointer chase one load at a time.  Each load depends on
+ * the previous, so the time per call is the latency of a load from
+ * wherever in the memory hierarchy the working set fits.  The position
+ * is kept in a register for the duration of the loop so as not to add
+ * a store and reload to each step.
+ */
+u_long
+pmt_chase_loop(pmt_share_t *shr, pmt_priv_t *priv,
+               u_long iters, volatile u_int *stop)
+{
+    void **chase = priv->chase;
+    u_long n = 0;
+    int i;
+
+    if (iters > 0) {
+        for (; iters - n >= PMT_LOOP_UNROLL; n += PMT_LOOP_UNROLL) {
+            PMT_LOOP_UNROLLED(PMT_LOOP_UNROLL)
+            for (i = 0; i < PMT_LOOP_UNROLL; ++i)
+                chase = *chase;
+        }
+        for (; n < iters; ++n)
+            chase = *chase;
+    } else {
+        while (!*stop) {
+            PMT_LOOP_UNROLLED(PMT_LOOP_UNROLL)
+            for (i = 0; i < PMT_LOOP_UNROLL; ++i)
+                chase = *chase;
+            n += PMT_LOOP_UNROLL;
+        }
+    }
+
+    priv->chase = chase;
+
+    return n;
+}
+
+
+/* STREAM-style bandwidth kernels over the worker's three arrays a, b
+ * and c, each a third of its slice rounded down to whole cache lines.
+ * Each call processes one cache line of each array involved, wrapping
+ * around at the end of the arrays.  The kernels are done in integer
+ * arithmetic so that they can run in the kernel.
+ */
+#define PMT_STREAM_LINE     (CACHE_LINE_SIZE / sizeof(u_long))
+
+#define PMT_STREAM_DEFINE(name, kernel)                                 \
+    u_long                                                              \
+    name##_loop(pmt_share_t *shr, pmt_priv_t *priv,                     \
+                u_long iters, volatile u_int *stop)                     \
+    {                                                                   \
+        size_t n = priv->wss / (3 * CACHE_LINE_SIZE) * PMT_STREAM_LINE; \
+        u_long *a = priv->wsbase;                                       \
+        u_long *b = a + n;                                              \
+        u_long *c = b + n;                                              \
+        const u_long q __unused = 3;                                    \
+        size_t pos = priv->pos;                                         \
+        u_long calls = 0;                                               \
+        size_t j;                                                       \
+                                                                        \
+        while (iters > 0 ? calls < iters : !*stop) {                    \
+            for (j = pos; j < pos + PMT_STREAM_LINE; ++j)               \
+                kernel;                                                 \
+                                                                        \
+            pos += PMT_STREAM_LINE;                                     \
+            if (pos >= n)                                               \
+                pos = 0;                                                \
+            ++calls;                                                    \
+        }                                                               \
+                                                                        \
+        priv->pos = pos;                                                \
+                                                                        \
+        return calls;                                                   \
+    }
+
+PMT_STREAM_DEFINE(pmt_stream_copy, c[j] = a[j])
+PMT_STREAM_DEFINE(pmt_stream_scale, b[j] = q * c[j])
+PMT_STREAM_DEFINE(pmt_stream_add, c[j] = a[j] + b[j])
+PMT_STREAM_DEFINE(pmt_stream_triad, a[j] = b[j] + q * c[j])
+
+
+/* Increment a shared counter (no synchronization).
+ */
+PMT_TEST_DEFINE(pmt_inc_shared)
+{
+    ++shr->count;
+}
+
 
 /* Increment a per-cpu counter.
  */
-int
-pmt_inc_pcpu_every(pmt_share_t *shr, pmt_priv_t *priv)
+PMT_TEST_DEFINE(pmt_inc_pcpu)
 {
     ++priv->count;
+}
 
-    return 0;
+
+/* Increment a per-cpu counter placed at a fixed stride from those of
+ * the other workers.
+ */
+PMT_TEST_DEFINE_LOOP(pmt_inc_stride)
+{
+    ++*(u_long *)priv->wsbase;
+}
+
+
+/* Model the work done by a lock test's caller:  Spin for the given
+ * number of pause loops and touch the given number of bytes of buf, one
+ * access per cache line, writing them if write is set (i.e., under an
+ * exclusive lock or in private data) and reading them otherwise.  Both
+ * are fixed per call so that a given setting is reproducible.
+ */
+static __always_inline void
+pmt_work(pmt_priv_t *priv, volatile u_char *buf, u_int bytes, u_int spins, int write)
+{
+    u_int off;
+
+    for (off = 0; off < bytes; off += CACHE_LINE_SIZE) {
+        if (write)
+            ++buf[off];
+        else
+            priv->count += buf[off];
+    }
+
+    while (spins-- > 0)
+        cpu_spinwait();
+}
+
+/* The work done while holding the lock, on the shared cs_buf.
+ */
+static __always_inline void
+pmt_work_cs(pmt_share_t *shr, pmt_priv_t *priv, int write)
+{
+    pmt_work(priv, shr->cs_buf, priv->cs_bytes, priv->cs_spins, write);
+}
+
+/* The work done between releasing and reacquiring the lock, on the
+ * private think_buf.
+ */
+static __always_inline void
+pmt_work_think(pmt_priv_t *priv)
+{
+    pmt_work(priv, priv->think_buf, priv->think_bytes, priv->think_spins, 1);
 }
 
 
 /* Use a mutex to increment a shared counter.
  */
-int
-pmt_mtx_every(pmt_share_t *shr, pmt_priv_t *priv)
+PMT_TEST_DEFINE(pmt_mtx)
 {
     mtx_lock_flags(&shr->mtx, MTX_QUIET);
     ++shr->mtx_count;
+    pmt_work_cs(shr, priv, 1);
     mtx_unlock(&shr->mtx);
-
-    return 0;
+    pmt_work_think(priv);
 }
 
 
 /* Use a spin mutex to increment a shared counter.
  */
-int
-pmt_mtx_spin_every(pmt_share_t *shr, pmt_priv_t *priv)
+PMT_TEST_DEFINE(pmt_mtx_spin)
 {
     mtx_lock_spin_flags(&shr->spin, MTX_QUIET);
     ++shr->spin_count;
+    pmt_work_cs(shr, priv, 1);
     mtx_unlock_spin(&shr->spin);
-
-    return 0;
+    pmt_work_think(priv);
 }
 
 
 /* Use an sx shared lock to increment a private counter
  */
-int
-pmt_sx_slock_every(pmt_share_t *shr, pmt_priv_t *priv)
+PMT_TEST_DEFINE(pmt_sx_slock)
 {
     sx_slock(&shr->sx);
     ++priv->count;
+    pmt_work_cs(shr, priv, 0);
     sx_sunlock(&shr->sx);
-
-    return 0;
+    pmt_work_think(priv);
 }
 
 
 /* Use an sx exclusive lock to increment a shared counter.
  */
-int
-pmt_sx_xlock_every(pmt_share_t *shr, pmt_priv_t *priv)
+PMT_TEST_DEFINE(pmt_sx_xlock)
 {
     sx_xlock(&shr->sx);
     ++shr->sx_count;
+    pmt_work_cs(shr, priv, 1);
     sx_xunlock(&shr->sx);
-
-    return 0;
+    pmt_work_think(priv);
 }
 
 
 /* Use an rw read lock to do increment a private counter.
  */
-int
-pmt_rw_rlock_every(pmt_share_t *shr, pmt_priv_t *priv)
+PMT_TEST_DEFINE(pmt_rw_rlock)
 {
     rw_rlock(&shr->rw);
     ++priv->count;
+    pmt_work_cs(shr, priv, 0);
     rw_runlock(&shr->rw);
-
-    return 0;
+    pmt_work_think(priv);
 }
 
 
 /* Use an rw write lock to increment a shared counter.
  */
-int
-pmt_rw_wlock_every(pmt_share_t *shr, pmt_priv_t *priv)
+PMT_TEST_DEFINE(pmt_rw_wlock)
 {
     rw_wlock(&shr->rw);
     ++shr->rw_count;
+    pmt_work_cs(shr, priv, 1);
     rw_wunlock(&shr->rw);
-
-    return 0;
+    pmt_work_think(priv);
 }
 
 
 /* Use an rm read lock to increment a private counter.
  */
-int
-pmt_rm_rlock_every(pmt_share_t *shr, pmt_priv_t *priv)
+PMT_TEST_DEFINE(pmt_rm_rlock)
 {
     struct rm_priotracker tracker;
 
     rm_rlock(&shr->rm, &tracker);
     ++priv->count;
+    pmt_work_cs(shr, priv, 0);
     rm_runlock(&shr->rm, &tracker);
-
-    return 0;
+    pmt_work_think(priv);
 }
 
 
 /* Use an rm write lock to increment a shared counter.
  */
-int
-pmt_rm_wlock_every(pmt_share_t *shr, pmt_priv_t *priv)
+PMT_TEST_DEFINE(pmt_rm_wlock)
 {
     rm_wlock(&shr->rm);
     ++shr->rm_count;
+    pmt_work_cs(shr, priv, 1);
     rm_wunlock(&shr->rm);
+    pmt_work_think(priv);
+}
 
-    return 0;
+
+/* The mixed tests take either the read or the write lock on each call,
+ * choosing to write with probability priv->write_ppm per million.  Each
+ * call is timed with the TSC so that the costs of the reads and of the
+ * writes can be reported separately.
+ */
+static __always_inline int
+pmt_mix_write(pmt_priv_t *priv)
+{
+    uint64_t x = priv->rng;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    priv->rng = x;
+
+    return ((x >> 32) * 1000000) >> 32 < priv->write_ppm;
+}
+
+static __always_inline void
+pmt_mix_account(pmt_priv_t *priv, int write, uint64_t start)
+{
+    uint64_t cycles = rdtsc() - start;
+
+    if (write) {
+        priv->write_cycles += cycles;
+        ++priv->writes;
+    } else {
+        priv->read_cycles += cycles;
+        ++priv->reads;
+    }
+}
+
+/* Mix rw read locks (incrementing a private counter) with rw write
+ * locks (incrementing a shared counter).
+ */
+PMT_TEST_DEFINE_LOOP(pmt_rw_mix)
+{
+    int write = pmt_mix_write(priv);
+    uint64_t start = rdtsc();
+
+    if (write) {
+        rw_wlock(&shr->rw);
+        ++shr->rw_count;
+        rw_wunlock(&shr->rw);
+    } else {
+        rw_rlock(&shr->rw);
+        ++priv->count;
+        rw_runlock(&shr->rw);
+    }
+
+    pmt_mix_account(priv, write, start);
+}
+
+/* Mix rm read locks with rm write locks.
+ */
+PMT_TEST_DEFINE_LOOP(pmt_rm_mix)
+{
+    int write = pmt_mix_write(priv);
+    uint64_t start = rdtsc();
+
+    if (write) {
+        rm_wlock(&shr->rm);
+        ++shr->rm_count;
+        rm_wunlock(&shr->rm);
+    } else {
+        struct rm_priotracker tracker;
+
+        rm_rlock(&shr->rm, &tracker);
+        ++priv->count;
+        rm_runlock(&shr->rm, &tracker);
+    }
+
+    pmt_mix_account(priv, write, start);
+}
+
+/* Mix sx shared locks with sx exclusive locks.
+ */
+PMT_TEST_DEFINE_LOOP(pmt_sx_mix)
+{
+    int write = pmt_mix_write(priv);
+    uint64_t start = rdtsc();
+
+    if (write) {
+        sx_xlock(&shr->sx);
+        ++shr->sx_count;
+        sx_xunlock(&shr->sx);
+    } else {
+        sx_slock(&shr->sx);
+        ++priv->count;
+        sx_sunlock(&shr->sx);
+    }
+
+    pmt_mix_account(priv, write, start);
 }
 
 
 /* Use an rw read lock to increment an atomic shared variable.
  */
-int
-pmt_rw_rlock_atomic_add_every(pmt_share_t *shr, pmt_priv_t *priv)
+PMT_TEST_DEFINE(pmt_rw_rlock_atomic_add)
 {
     rw_rlock(&shr->rw);
     atomic_add_long(&shr->rw_count, 1);
     rw_runlock(&shr->rw);
-
-    return 0;
 }
 
 
 /* Use atomic_add_long() to increment a shared variable.
  */
-int
-pmt_atomic_add_long_every(pmt_share_t *shr, pmt_priv_t *priv)
+PMT_TEST_DEFINE(pmt_atomic_add_long)
 {
     atomic_add_long(&shr->count, 1);
-
-    return 0;
 }
 
 
 /* Use atomic_fetchadd_long() to increment a shared variable.
  */
-int
-pmt_atomic_fetchadd_long_every(pmt_share_t *shr, pmt_priv_t *priv)
+PMT_TEST_DEFINE(pmt_atomic_fetchadd_long)
 {
     atomic_fetchadd_long(&shr->count, 1);
-
-    return 0;
 }
 
 
 /* Use atomic_cmpset_long() to increment a shared variable.
  */
-int
-pmt_atomic_cmpset_long_every(pmt_share_t *shr, pmt_priv_t *priv)
+PMT_TEST_DEFINE(pmt_atomic_cmpset_long)
 {
     int set;
 
@@ -215,32 +471,622 @@ pmt_atomic_cmpset_long_every(pmt_share_t *shr, pmt_priv_t *priv)
 
         set = atomic_cmpset_long(&shr->count, old, old + 1);
     } while (!set);
-
-    return 0;
 }
 
 
 /* Call nanotime().
  */
-int
-pmt_nanotime_every(pmt_share_t *shr, pmt_priv_t *priv)
+PMT_TEST_DEFINE(pmt_nanotime)
 {
     struct timespec ts;
 
     nanotime(&ts);
-
-    return 0;
 }
 
 
 /* Call getnanotime().
  */
-int
-pmt_getnanotime_every(pmt_share_t *shr, pmt_priv_t *priv)
+PMT_TEST_DEFINE(pmt_getnanotime)
 {
     struct timespec ts;
 
     getnanotime(&ts);
+}
 
-    return 0;
+
+/* Lock-free data structures.  The waits on a full or empty structure
+ * give up once a timed sample has been told to stop, as the workers may
+ * by then have made differing numbers of pushes and pops.
+ */
+static __always_inline int
+pmt_halted(pmt_priv_t *priv)
+{
+    cpu_spinwait();
+
+    return *priv->halt;
+}
+
+/* Initialize the MPMC ring as empty and the Treiber stack with all its
+ * nodes pushed.
+ */
+void
+pmt_lockfree_init(pmt_share_t *shr)
+{
+    int i;
+
+    for (i = 0; i < PMT_MPMC_SIZE; ++i)
+        shr->mpmcv[i].seq = i;
+
+    for (i = 0; i < PMT_STACK_SIZE - 1; ++i)
+        shr->stack_nextv[i] = i + 1;
+
+    shr->stack_nextv[i] = PMT_STACK_NIL;
+    shr->stack_top = 0;
+}
+
+
+/* Enqueue val onto the bounded MPMC ring (after Dmitry Vyukov's).  Each
+ * slot's sequence number tells whether it is ready to be filled or to
+ * be drained at a given position, so the producers and consumers each
+ * contend only on their own position counter.  Returns 0 only if halted
+ * while the ring is full.
+ */
+static __always_inline int
+pmt_mpmc_enqueue(pmt_share_t *shr, pmt_priv_t *priv, u_long val)
+{
+    pmt_mpmc_slot_t *slot;
+    u_long pos;
+    long dif;
+
+    pos = shr->mpmc_tail;
+
+    for (;;) {
+        slot = &shr->mpmcv[pos % PMT_MPMC_SIZE];
+        dif = (long)(atomic_load_acq_long(&slot->seq) - pos);
+
+        if (dif == 0) {
+            if (atomic_cmpset_long(&shr->mpmc_tail, pos, pos + 1))
+                break;
+        } else if (dif < 0 && pmt_halted(priv)) {
+            return 0;
+        }
+
+        pos = shr->mpmc_tail;
+    }
+
+    slot->val = val;
+    atomic_store_rel_long(&slot->seq, pos + 1);
+
+    return 1;
+}
+
+/* Dequeue the oldest value from the MPMC ring into *valp.  Returns 0
+ * only if halted while the ring is empty.
+ */
+static __always_inline int
+pmt_mpmc_dequeue(pmt_share_t *shr, pmt_priv_t *priv, u_long *valp)
+{
+    pmt_mpmc_slot_t *slot;
+    u_long pos;
+    long dif;
+
+    pos = shr->mpmc_head;
+
+    for (;;) {
+        slot = &shr->mpmcv[pos % PMT_MPMC_SIZE];
+        dif = (long)(atomic_load_acq_long(&slot->seq) - (pos + 1));
+
+        if (dif == 0) {
+            if (atomic_cmpset_long(&shr->mpmc_head, pos, pos + 1))
+                break;
+        } else if (dif < 0 && pmt_halted(priv)) {
+            return 0;
+        }
+
+        pos = shr->mpmc_head;
+    }
+
+    *valp = slot->val;
+    atomic_store_rel_long(&slot->seq, pos + PMT_MPMC_SIZE);
+
+    return 1;
+}
+
+/* Enqueue and then dequeue a value on the shared MPMC ring.
+ */
+PMT_TEST_DEFINE(pmt_mpmc)
+{
+    u_long val;
+
+    if (pmt_mpmc_enqueue(shr, priv, priv->count) &&
+        pmt_mpmc_dequeue(shr, priv, &val))
+        priv->count = val + 1;
+}
+
+
+/* Push val onto the SPSC ring in the given private data.  The producer
+ * rereads the consumer's head only when its cached copy shows the ring
+ * as full, and the consumer likewise for the tail, so that in the steady
+ * state each side mostly touches only its own cache line.
+ */
+static __always_inline int
+pmt_spsc_push(pmt_priv_t *priv, pmt_priv_t *ring, u_long val)
+{
+    u_long tail = ring->spsc_tail;
+
+    while (tail - ring->spsc_head_cache >= PMT_SPSC_SIZE) {
+        ring->spsc_head_cache = atomic_load_acq_long(&ring->spsc_head);
+
+        if (tail - ring->spsc_head_cache >= PMT_SPSC_SIZE && pmt_halted(priv))
+            return 0;
+    }
+
+    ring->spsc_ringv[tail % PMT_SPSC_SIZE] = val;
+    atomic_store_rel_long(&ring->spsc_tail, tail + 1);
+
+    return 1;
+}
+
+static __always_inline int
+pmt_spsc_pop(pmt_priv_t *priv, pmt_priv_t *ring, u_long *valp)
+{
+    u_long head = ring->spsc_head;
+
+    while (head == ring->spsc_tail_cache) {
+        ring->spsc_tail_cache = atomic_load_acq_long(&ring->spsc_tail);
+
+        if (head == ring->spsc_tail_cache && pmt_halted(priv))
+            return 0;
+    }
+
+    *valp = ring->spsc_ringv[head % PMT_SPSC_SIZE];
+    atomic_store_rel_long(&ring->spsc_head, head + 1);
+
+    return 1;
+}
+
+/* Each even worker pushes one value per call to the following worker's
+ * ring, which that worker pops one per call.  A worker left without a
+ * partner pushes to and pops from its own ring.
+ */
+PMT_TEST_DEFINE(pmt_spsc)
+{
+    u_long val;
+
+    switch (priv->spsc) {
+    case PMT_SPSC_PRODUCER:
+        pmt_spsc_push(priv, priv->ring, priv->count++);
+        break;
+
+    case PMT_SPSC_CONSUMER:
+        if (pmt_spsc_pop(priv, priv, &val))
+            priv->count = val;
+        break;
+
+    default:
+        if (pmt_spsc_push(priv, priv, priv->count) &&
+            pmt_spsc_pop(priv, priv, &val))
+            priv->count = val + 1;
+        break;
+    }
+}
+
+
+/* Pop the top node index from the Treiber stack, or return PMT_STACK_NIL
+ * if halted while the stack is empty.  The top of stack word carries a
+ * tag that is bumped on every push and pop, so that the cmpset fails if
+ * the node was popped and pushed back while we were looking at it (the
+ * ABA problem).
+ */
+static __always_inline u_long
+pmt_stack_pop(pmt_share_t *shr, pmt_priv_t *priv)
+{
+    u_long top, idx, next;
+
+    for (;;) {
+        top = atomic_load_acq_long(&shr->stack_top);
+        idx = top & PMT_STACK_NIL;
+
+        if (idx == PMT_STACK_NIL) {
+            if (pmt_halted(priv))
+                return PMT_STACK_NIL;
+            continue;
+        }
+
+        next = shr->stack_nextv[idx];
+
+        if (atomic_cmpset_acq_long(&shr->stack_top, top,
+                                   ((top & ~PMT_STACK_NIL) + PMT_STACK_TAG) | next))
+            return idx;
+    }
+}
+
+static __always_inline void
+pmt_stack_push(pmt_share_t *shr, u_long idx)
+{
+    u_long top;
+
+    do {
+        top = shr->stack_top;
+        shr->stack_nextv[idx] = top & PMT_STACK_NIL;
+    } while (!atomic_cmpset_rel_long(&shr->stack_top, top,
+                                     ((top & ~PMT_STACK_NIL) + PMT_STACK_TAG) | idx));
+}
+
+/* Pop a node from the shared Treiber stack and push it back.
+ */
+PMT_TEST_DEFINE(pmt_treiber)
+{
+    u_long idx = pmt_stack_pop(shr, priv);
+
+    if (idx != PMT_STACK_NIL)
+        pmt_stack_push(shr, idx);
+}
+
+
+/* Spinlocks.  Each test holds off preemption (in the kernel) across the
+ * acquire and release, as a spin mutex does, so that the waiters never
+ * spin on a preempted holder.  The counter each protects lies in the
+ * same cache line as its lock.
+ */
+#define PMT_BACKOFF_MAX     (1024)  // Max ttas backoff (in cpu_spinwait()s)
+
+/* Initialize the CLH queue with an unlocked dummy node.
+ */
+void
+pmt_spinlock_init(pmt_share_t *shr)
+{
+    shr->clh_tail = (u_long)&shr->clh_dummy;
+}
+
+/* Test-and-set:  Every waiter hammers on the lock word with cmpset.
+ */
+static __always_inline void
+pmt_tas_acquire(volatile u_int *lock)
+{
+    while (!atomic_cmpset_acq_int(lock, 0, 1))
+        cpu_spinwait();
+}
+
+static __always_inline void
+pmt_tas_release(volatile u_int *lock)
+{
+    atomic_store_rel_int(lock, 0);
+}
+
+/* Test-and-test-and-set:  Waiters spin reading the lock word (in their
+ * own caches) until it's released, then try to cmpset it, backing off
+ * exponentially after each failed try.
+ */
+static __always_inline void
+pmt_ttas_acquire(volatile u_int *lock)
+{
+    u_int backoff = 1;
+    u_int i;
+
+    for (;;) {
+        while (*lock)
+            cpu_spinwait();
+
+        if (atomic_cmpset_acq_int(lock, 0, 1))
+            break;
+
+        for (i = 0; i < backoff; ++i)
+            cpu_spinwait();
+
+        if (backoff < PMT_BACKOFF_MAX)
+            backoff *= 2;
+    }
+}
+
+/* Ticket:  Waiters take a ticket and are served in FIFO order, but all
+ * spin on the same owner word.
+ */
+static __always_inline void
+pmt_ticket_acquire(pmt_share_t *shr)
+{
+    u_int ticket = atomic_fetchadd_int(&shr->ticket_next, 1);
+
+    while (atomic_load_acq_int(&shr->ticket_owner) != ticket)
+        cpu_spinwait();
+}
+
+static __always_inline void
+pmt_ticket_release(pmt_share_t *shr)
+{
+    atomic_store_rel_int(&shr->ticket_owner, shr->ticket_owner + 1);
+}
+
+/* MCS:  Waiters queue up their own nodes and each spins only on its own
+ * node until its predecessor hands it the lock.
+ */
+static __always_inline void
+pmt_mcs_acquire(volatile u_long *tail, pmt_qnode_t *node)
+{
+    pmt_qnode_t *pred;
+
+    node->next = 0;
+    node->locked = 1;
+    atomic_thread_fence_rel();
+
+    pred = (pmt_qnode_t *)atomic_swap_long(tail, (u_long)node);
+    if (pred) {
+        atomic_store_rel_long(&pred->next, (u_long)node);
+
+        while (atomic_load_acq_int(&node->locked))
+            cpu_spinwait();
+    }
+
+    atomic_thread_fence_acq();
+}
+
+static __always_inline void
+pmt_mcs_release(volatile u_long *tail, pmt_qnode_t *node)
+{
+    pmt_qnode_t *next;
+
+    next = (pmt_qnode_t *)atomic_load_acq_long(&node->next);
+    if (!next) {
+        if (atomic_cmpset_rel_long(tail, (u_long)node, 0))
+            return;
+
+        /* A successor has swapped itself in but not yet linked up.
+         */
+        while (!(next = (pmt_qnode_t *)atomic_load_acq_long(&node->next)))
+            cpu_spinwait();
+    }
+
+    atomic_store_rel_int(&next->locked, 0);
+}
+
+/* CLH:  Each waiter spins on its predecessor's node, and on release
+ * leaves its own node for its successor and takes its predecessor's.
+ */
+static __always_inline void
+pmt_clh_acquire(volatile u_long *tail, pmt_priv_t *priv)
+{
+    pmt_qnode_t *node = priv->clh;
+    pmt_qnode_t *pred;
+
+    node->locked = 1;
+    atomic_thread_fence_rel();
+
+    pred = (pmt_qnode_t *)atomic_swap_long(tail, (u_long)node);
+
+    while (atomic_load_acq_int(&pred->locked))
+        cpu_spinwait();
+
+    priv->clh_pred = pred;
+}
+
+static __always_inline void
+pmt_clh_release(pmt_priv_t *priv)
+{
+    atomic_store_rel_int(&priv->clh->locked, 0);
+    priv->clh = priv->clh_pred;
+}
+
+/* Queued (after Linux's qspinlock):  Try to grab the lock word, else
+ * queue up MCS style, so that only the waiter at the head of the queue
+ * spins on the lock word.
+ */
+static __always_inline void
+pmt_qspin_acquire(pmt_share_t *shr, pmt_priv_t *priv)
+{
+    if (atomic_cmpset_acq_int(&shr->qspin, 0, 1))
+        return;
+
+    pmt_mcs_acquire(&shr->qspin_tail, &priv->mcs_node);
+
+    while (shr->qspin || !atomic_cmpset_acq_int(&shr->qspin, 0, 1))
+        cpu_spinwait();
+
+    pmt_mcs_release(&shr->qspin_tail, &priv->mcs_node);
+}
+
+/* Use each of the spinlocks to increment a shared counter.
+ */
+PMT_TEST_DEFINE(pmt_tas_lock)
+{
+    critical_enter();
+    pmt_tas_acquire(&shr->tas);
+    ++shr->tas_count;
+    pmt_tas_release(&shr->tas);
+    critical_exit();
+}
+
+PMT_TEST_DEFINE(pmt_ttas_lock)
+{
+    critical_enter();
+    pmt_ttas_acquire(&shr->ttas);
+    ++shr->ttas_count;
+    pmt_tas_release(&shr->ttas);
+    critical_exit();
+}
+
+PMT_TEST_DEFINE(pmt_ticket_lock)
+{
+    critical_enter();
+    pmt_ticket_acquire(shr);
+    ++shr->ticket_count;
+    pmt_ticket_release(shr);
+    critical_exit();
+}
+
+PMT_TEST_DEFINE(pmt_mcs_lock)
+{
+    critical_enter();
+    pmt_mcs_acquire(&shr->mcs_tail, &priv->mcs_node);
+    ++shr->mcs_count;
+    pmt_mcs_release(&shr->mcs_tail, &priv->mcs_node);
+    critical_exit();
+}
+
+PMT_TEST_DEFINE(pmt_clh_lock)
+{
+    critical_enter();
+    pmt_clh_acquire(&shr->clh_tail, priv);
+    ++shr->clh_count;
+    pmt_clh_release(priv);
+    critical_exit();
+}
+
+PMT_TEST_DEFINE(pmt_qspin_lock)
+{
+    critical_enter();
+    pmt_qspin_acquire(shr, priv);
+    ++shr->qspin_count;
+    pmt_tas_release(&shr->qspin);
+    critical_exit();
+}
+
+
+/* Park the calling thread for as long as *word is val.  Returns
+ * immediately (and zero) if *word has already changed, otherwise
+ * returns non-zero once woken.
+ */
+static int
+pmt_park(volatile u_int *word, u_int val)
+{
+#ifdef _KERNEL
+    void *wchan = __DEVOLATILE(void *, word);
+
+    sleepq_lock(wchan);
+    if (*word != val) {
+        sleepq_release(wchan);
+        return 0;
+    }
+
+    sleepq_add(wchan, NULL, "pmtpark", SLEEPQ_SLEEP, 0);
+    sleepq_wait(wchan, 0);
+
+    return 1;
+#else
+    return syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0) == 0;
+#endif
+}
+
+/* Wake one thread parked on word.
+ */
+static void
+pmt_unpark(volatile u_int *word)
+{
+#ifdef _KERNEL
+    wakeup_one(__DEVOLATILE(void *, word));
+#else
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+}
+
+/* Adaptive lock:  Spin on a held lock up to spin_budget times, then
+ * mark the lock as having waiters and park until woken by the release.
+ * The lock word is 0 when free, 1 when held, and 2 when held and there
+ * may be parked waiters (after Drepper's "Futexes Are Tricky").
+ */
+static __always_inline void
+pmt_adaptive_acquire(volatile u_int *lock, u_int spin_budget)
+{
+    u_int i;
+
+    if (atomic_cmpset_acq_int(lock, 0, 1))
+        return;
+
+    for (i = 0; i < spin_budget; ++i) {
+        cpu_spinwait();
+
+        if (*lock == 0 && atomic_cmpset_acq_int(lock, 0, 1))
+            return;
+    }
+
+    while (atomic_swap_int(lock, 2) != 0)
+        pmt_park(lock, 2);
+
+    atomic_thread_fence_acq();
+}
+
+static __always_inline void
+pmt_adaptive_release(volatile u_int *lock)
+{
+    if (atomic_swap_int(lock, 0) == 2)
+        pmt_unpark(lock);
+}
+
+/* Use a shared adaptive lock, spinning up to debug.pmt.spin_budget
+ * times before parking, to increment a shared counter.
+ */
+PMT_TEST_DEFINE(pmt_adaptive_lock)
+{
+    pmt_adaptive_acquire(&shr->adaptive, priv->spin_budget);
+    ++shr->adaptive_count;
+    pmt_adaptive_release(&shr->adaptive);
+}
+
+/* Measure the handoff latency of the adaptive lock from worker 0 to a
+ * parked worker 1, i.e., the time from worker 0's release to worker 1
+ * running with the lock, one handoff per call.  Worker 0 takes the lock,
+ * waits for worker 1 to say it is about to park on it, and then gives
+ * it handoff_wait cycles to actually go to sleep before releasing it.
+ * Handoffs in which worker 1 nonetheless never slept are counted apart
+ * rather than measured.  Any other workers sit out, as does worker 0 if
+ * it has no partner.
+ *
+ * Both workers must make the same number of calls, so as with the
+ * ping-pong tests the results of timed samples are approximate.
+ */
+PMT_TEST_DEFINE_EVERY(pmt_handoff)
+{
+    u_long seq = priv->count++ * 2;
+    uint64_t start;
+    int slept;
+
+    if (priv->nworkers < 2)
+        return;
+
+    if (priv->worker == 0) {
+        pmt_adaptive_acquire(&shr->handoff, 0);
+        atomic_store_rel_long(&shr->handoff_seq, seq + 1);
+
+        while (shr->handoff_parking != seq + 1 && !*priv->halt)
+            cpu_spinwait();
+
+        start = rdtsc();
+        while (rdtsc() - start < priv->handoff_wait && !*priv->halt)
+            cpu_spinwait();
+
+        shr->handoff_stamp = rdtsc();
+        pmt_adaptive_release(&shr->handoff);
+
+        while (shr->handoff_seq != seq + 2 && !*priv->halt)
+            cpu_spinwait();
+    } else if (priv->worker == 1) {
+        while (shr->handoff_seq != seq + 1) {
+            if (*priv->halt)
+                return;
+            cpu_spinwait();
+        }
+
+        /* Acquire as pmt_adaptive_acquire() does with no spinning, but
+         * note when we are about to park and whether we slept.
+         */
+        slept = 0;
+        if (!atomic_cmpset_acq_int(&shr->handoff, 0, 1)) {
+            while (atomic_swap_int(&shr->handoff, 2) != 0) {
+                atomic_store_rel_long(&shr->handoff_parking, seq + 1);
+                slept |= pmt_park(&shr->handoff, 2);
+            }
+
+            atomic_thread_fence_acq();
+        }
+
+        if (slept) {
+            priv->handoff_cycles += rdtsc() - shr->handoff_stamp;
+            ++priv->handoffs;
+        } else {
+            ++priv->handoff_nosleep;
+        }
+
+        pmt_adaptive_release(&shr->handoff);
+
+        atomic_store_rel_long(&shr->handoff_seq, seq + 2);
+    }
 }
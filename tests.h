@@ -7,7 +7,114 @@
 #ifndef PMT_TESTS_H
 #define PMT_TESTS_H
 
+/* Number of test bodies per trip through a specialized test loop.
+ */
+#ifndef PMT_LOOP_UNROLL
+#define PMT_LOOP_UNROLL     8
+#endif
+
+#define PMT_LOOP_PRAGMA(x)  _Pragma(#x)
+#define PMT_LOOP_UNROLLED(n) PMT_LOOP_PRAGMA(GCC unroll n)
+
+/* Run the inlined test body PMT_LOOP_UNROLL times per trip through the
+ * loop, either for iters iterations or (if iters is 0) until *stop is
+ * set.  The compiler barrier after each body keeps the compiler from
+ * merging or hoisting the bodies, so that each iteration does the same
+ * memory accesses as a call through every() would.
+ */
+#define PMT_LOOP_BODY(body)                                             \
+    u_long n = 0;                                                       \
+    int i;                                                              \
+                                                                        \
+    if (iters > 0) {                                                    \
+        for (; iters - n >= PMT_LOOP_UNROLL; n += PMT_LOOP_UNROLL) {    \
+            PMT_LOOP_UNROLLED(PMT_LOOP_UNROLL)                          \
+            for (i = 0; i < PMT_LOOP_UNROLL; ++i) {                     \
+                body(shr, priv);                                        \
+                __compiler_membar();                                    \
+            }                                                           \
+        }                                                               \
+        for (; n < iters; ++n) {                                        \
+            body(shr, priv);                                            \
+            __compiler_membar();                                        \
+        }                                                               \
+    } else {                                                            \
+        while (!*stop) {                                                \
+            PMT_LOOP_UNROLLED(PMT_LOOP_UNROLL)                          \
+            for (i = 0; i < PMT_LOOP_UNROLL; ++i) {                     \
+                body(shr, priv);                                        \
+                __compiler_membar();                                    \
+            }                                                           \
+            n += PMT_LOOP_UNROLL;                                       \
+        }                                                               \
+    }                                                                   \
+                                                                        \
+    return n
+
+/* Define a test from a single body, generating both the name_every()
+ * callback and the name_loop() specialized loop in which the body is
+ * inlined.  The braces following PMT_TEST_DEFINE(name) are the body.
+ */
+#define PMT_TEST_DEFINE(name)                                           \
+    static __always_inline void                                         \
+    name##_body(pmt_share_t *shr, pmt_priv_t *priv);                    \
+                                                                        \
+    int                                                                 \
+    name##_every(pmt_share_t *shr, pmt_priv_t *priv)                    \
+    {                                                                   \
+        name##_body(shr, priv);                                         \
+                                                                        \
+        return 0;                                                       \
+    }                                                                   \
+                                                                        \
+    u_long                                                              \
+    name##_loop(pmt_share_t *shr, pmt_priv_t *priv,                     \
+                u_long iters, volatile u_int *stop)                     \
+    {                                                                   \
+        PMT_LOOP_BODY(name##_body);                                     \
+    }                                                                   \
+                                                                        \
+    static __always_inline void                                         \
+    name##_body(pmt_share_t *shr, pmt_priv_t *priv)
+
+/* Define a test that runs only through its name_loop() specialized
+ * loop, for tests that have no every() callback.
+ */
+#define PMT_TEST_DEFINE_LOOP(name)                                      \
+    static __always_inline void                                         \
+    name##_body(pmt_share_t *shr, pmt_priv_t *priv);                    \
+                                                                        \
+    u_long                                                              \
+    name##_loop(pmt_share_t *shr, pmt_priv_t *priv,                     \
+                u_long iters, volatile u_int *stop)                     \
+    {                                                                   \
+        PMT_LOOP_BODY(name##_body);                                     \
+    }                                                                   \
+                                                                        \
+    static __always_inline void                                         \
+    name##_body(pmt_share_t *shr, pmt_priv_t *priv)
+
+/* Define a test that runs only through its name_every() callback, for
+ * tests whose calls can't be run back to back in an inlined loop.
+ */
+#define PMT_TEST_DEFINE_EVERY(name)                                     \
+    static __always_inline void                                         \
+    name##_body(pmt_share_t *shr, pmt_priv_t *priv);                    \
+                                                                        \
+    int                                                                 \
+    name##_every(pmt_share_t *shr, pmt_priv_t *priv)                    \
+    {                                                                   \
+        name##_body(shr, priv);                                         \
+                                                                        \
+        return 0;                                                       \
+    }                                                                   \
+                                                                        \
+    static __always_inline void                                         \
+    name##_body(pmt_share_t *shr, pmt_priv_t *priv)
+
 extern pmt_test_cb_t pmt_func_every;
+extern pmt_test_cb_t pmt_pingpong_every;
+extern pmt_test_cb_t pmt_pongping_every;
 extern pmt_test_cb_t pmt_inc_shared_every;
 extern pmt_test_cb_t pmt_inc_pcpu_every;
 extern pmt_test_cb_t pmt_mtx_every;
@@ -27,5 +134,55 @@ extern pmt_test_cb_t pmt_atomic_cmpset_long_every;
 extern pmt_test_cb_t pmt_atomic_add_acq_long_every;
 extern pmt_test_cb_t pmt_atomic_add_rel_long_every;
 extern pmt_test_cb_t pmt_atomic_fetchadd_long_every;
+extern pmt_test_cb_t pmt_mpmc_every;
+extern pmt_test_cb_t pmt_spsc_every;
+extern pmt_test_cb_t pmt_treiber_every;
+extern pmt_test_cb_t pmt_tas_lock_every;
+extern pmt_test_cb_t pmt_ttas_lock_every;
+extern pmt_test_cb_t pmt_ticket_lock_every;
+extern pmt_test_cb_t pmt_mcs_lock_every;
+extern pmt_test_cb_t pmt_clh_lock_every;
+extern pmt_test_cb_t pmt_qspin_lock_every;
+extern pmt_test_cb_t pmt_adaptive_lock_every;
+extern pmt_test_cb_t pmt_handoff_every;
+
+extern pmt_test_loop_t pmt_chase_loop;
+extern pmt_test_loop_t pmt_inc_stride_loop;
+extern pmt_test_loop_t pmt_stream_copy_loop;
+extern pmt_test_loop_t pmt_stream_scale_loop;
+extern pmt_test_loop_t pmt_stream_add_loop;
+extern pmt_test_loop_t pmt_stream_triad_loop;
+extern pmt_test_loop_t pmt_inc_shared_loop;
+extern pmt_test_loop_t pmt_inc_pcpu_loop;
+extern pmt_test_loop_t pmt_mtx_loop;
+extern pmt_test_loop_t pmt_mtx_spin_loop;
+extern pmt_test_loop_t pmt_sx_slock_loop;
+extern pmt_test_loop_t pmt_sx_xlock_loop;
+extern pmt_test_loop_t pmt_rw_rlock_loop;
+extern pmt_test_loop_t pmt_rw_wlock_loop;
+extern pmt_test_loop_t pmt_rm_rlock_loop;
+extern pmt_test_loop_t pmt_rm_wlock_loop;
+extern pmt_test_loop_t pmt_rw_rlock_atomic_add_loop;
+extern pmt_test_loop_t pmt_nanotime_loop;
+extern pmt_test_loop_t pmt_getnanotime_loop;
+extern pmt_test_loop_t pmt_atomic_add_long_loop;
+extern pmt_test_loop_t pmt_atomic_fetchadd_long_loop;
+extern pmt_test_loop_t pmt_atomic_cmpset_long_loop;
+extern pmt_test_loop_t pmt_rw_mix_loop;
+extern pmt_test_loop_t pmt_rm_mix_loop;
+extern pmt_test_loop_t pmt_sx_mix_loop;
+extern pmt_test_loop_t pmt_mpmc_loop;
+extern pmt_test_loop_t pmt_spsc_loop;
+extern pmt_test_loop_t pmt_treiber_loop;
+extern pmt_test_loop_t pmt_tas_lock_loop;
+extern pmt_test_loop_t pmt_ttas_lock_loop;
+extern pmt_test_loop_t pmt_ticket_lock_loop;
+extern pmt_test_loop_t pmt_mcs_lock_loop;
+extern pmt_test_loop_t pmt_clh_lock_loop;
+extern pmt_test_loop_t pmt_qspin_lock_loop;
+extern pmt_test_loop_t pmt_adaptive_lock_loop;
+
+void pmt_lockfree_init(pmt_share_t *shr);
+void pmt_spinlock_init(pmt_share_t *shr);
 
 #endif /* PMT_TESTS_H */